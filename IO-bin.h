@@ -0,0 +1,370 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef IO_BIN_INCLUDED
+#define IO_BIN_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <numa.h>
+#include "parallel.h"
+
+// Versioned binary graph format.
+//
+// A fixed header (n, m, id and offset widths, flags) is followed by up to
+// four page-aligned sections: out-offsets (n+1 longs), out-edges, and for
+// directed graphs in-offsets and in-edges. Weighted graphs store each edge
+// as a (neighbor, weight) pair, the same interleaving the Wgh vertices use
+// in memory. Every section records its position in the file, its length
+// and a checksum, so a loader can pread the sections in parallel straight
+// into their final arrays or mmap them, and no per-vertex records exist.
+
+#define BIN_GRAPH_MAGIC "POLYMRGR"
+#define BIN_GRAPH_VERSION 1
+#define BIN_ALIGN (4096)
+#define BIN_IO_CHUNK (1L << 24)
+
+#define BIN_FLAG_SYMMETRIC 1
+#define BIN_FLAG_WEIGHTED 2
+
+enum { BIN_OUT_OFFSETS, BIN_OUT_EDGES, BIN_IN_OFFSETS, BIN_IN_EDGES, BIN_NUM_SECTIONS };
+
+struct binSection {
+  uint64_t offset; // byte position in the file, 0 if absent
+  uint64_t length; // bytes
+  uint64_t checksum;
+};
+
+struct binGraphHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t idBytes; // sizeof(intE) of the writer
+  uint32_t offsetBytes;
+  uint64_t n;
+  uint64_t m;
+  binSection sections[BIN_NUM_SECTIONS];
+};
+
+// Position-weighted sum over the 32-bit words of a section; word i of the
+// section adds (i+1)*w, so swapped or shifted data changes the result.
+// startWord is the index of buf's first word within its section.
+inline uint64_t binChecksum(const void *buf, long bytes, long startWord) {
+  const uint32_t *w = (const uint32_t *)buf;
+  long words = bytes / sizeof(uint32_t);
+  long numChunks = (words + BIN_IO_CHUNK - 1) / BIN_IO_CHUNK;
+  uint64_t *partial = newA(uint64_t, numChunks + 1);
+  {parallel_for (long k = 0; k < numChunks; k++) {
+      long e = min(words, (k + 1) * BIN_IO_CHUNK);
+      uint64_t s = 0;
+      for (long i = k * BIN_IO_CHUNK; i < e; i++) s += (uint64_t)(startWord + i + 1) * w[i];
+      partial[k] = s;
+    }}
+  uint64_t sum = 0;
+  for (long k = 0; k < numChunks; k++) sum += partial[k];
+  free(partial);
+  return sum;
+}
+
+// Streams one section after another to fd, keeping each section's length
+// and checksum. Nothing larger than the caller's buffers is held in memory.
+struct binWriter {
+  int fd;
+  uint64_t pos;
+  binSection *cur;
+  binWriter(int _fd) : fd(_fd), pos(0), cur(NULL) {}
+
+  void writeAll(const void *buf, long size) {
+    long written = 0;
+    while (written < size) {
+      long w = write(fd, (const char *)buf + written, size - written);
+      if (w < 0) {
+	cout << "write failed" << endl;
+	abort();
+      }
+      written += w;
+    }
+    pos += size;
+  }
+
+  void pad() {
+    char zeros[BIN_ALIGN];
+    memset(zeros, 0, BIN_ALIGN);
+    long p = (BIN_ALIGN - pos % BIN_ALIGN) % BIN_ALIGN;
+    if (p > 0) writeAll(zeros, p);
+  }
+
+  void begin(binSection *s) {
+    pad();
+    cur = s;
+    cur->offset = pos;
+    cur->length = 0;
+    cur->checksum = 0;
+  }
+
+  void append(const void *buf, long size) {
+    cur->checksum += binChecksum(buf, size, cur->length / sizeof(uint32_t));
+    cur->length += size;
+    writeAll(buf, size);
+  }
+};
+
+// writes the offsets (n+1 longs) and the neighbor lists of one direction;
+// stride is 2 when weights are interleaved with the neighbors
+template <class vertex>
+void writeBinDirection(binWriter &w, binGraphHeader &h, vertex *V, long n, int stride, bool in) {
+  const long bufLen = 1 << 20;
+  long *offsets = newA(long, bufLen);
+  w.begin(&h.sections[in ? BIN_IN_OFFSETS : BIN_OUT_OFFSETS]);
+  long o = 0, k = 0;
+  for (long i = 0; i <= n; i++) {
+    offsets[k++] = o;
+    if (k == bufLen) { w.append(offsets, k * sizeof(long)); k = 0; }
+    if (i < n) o += in ? V[i].getInDegree() : V[i].getOutDegree();
+  }
+  if (k > 0) w.append(offsets, k * sizeof(long));
+  free(offsets);
+
+  intE *edges = newA(intE, bufLen);
+  w.begin(&h.sections[in ? BIN_IN_EDGES : BIN_OUT_EDGES]);
+  k = 0;
+  for (long i = 0; i < n; i++) {
+    long d = (in ? V[i].getInDegree() : V[i].getOutDegree()) * (long)stride;
+    intE *ngh = in ? V[i].getInNeighborPtr() : V[i].getOutNeighborPtr();
+    for (long j = 0; j < d; j++) {
+      edges[k++] = ngh[j];
+      if (k == bufLen) { w.append(edges, k * sizeof(intE)); k = 0; }
+    }
+  }
+  if (k > 0) w.append(edges, k * sizeof(intE));
+  free(edges);
+}
+
+template <class vertex>
+void writeBinGraph(vertex *V, long n, long m, bool symmetric, bool weighted, char *fileName) {
+  int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD);
+  if (fd < 0) {
+    cout << "Unable to open file: " << fileName << endl;
+    abort();
+  }
+  binGraphHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, BIN_GRAPH_MAGIC, 8);
+  h.version = BIN_GRAPH_VERSION;
+  h.flags = (symmetric ? BIN_FLAG_SYMMETRIC : 0) | (weighted ? BIN_FLAG_WEIGHTED : 0);
+  h.idBytes = sizeof(intE);
+  h.offsetBytes = sizeof(long);
+  h.n = n;
+  h.m = m;
+
+  binWriter w(fd);
+  w.writeAll(&h, sizeof(h));
+  int stride = weighted ? 2 : 1;
+  writeBinDirection(w, h, V, n, stride, false);
+  if (!symmetric) writeBinDirection(w, h, V, n, stride, true);
+  if (pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || close(fd) != 0) {
+    cout << "Write to " << fileName << " failed" << endl;
+    abort();
+  }
+  printf("wrote n & m: %ld %ld (%lu bytes)\n", n, m, (unsigned long)w.pos);
+}
+
+bool isBinGraphFile(char *fileName) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) return false;
+  char magic[8];
+  bool ok = (read(fd, magic, 8) == 8) && memcmp(magic, BIN_GRAPH_MAGIC, 8) == 0;
+  close(fd);
+  return ok;
+}
+
+binGraphHeader readBinHeader(int fd, char *fileName) {
+  binGraphHeader h;
+  struct stat st;
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || memcmp(h.magic, BIN_GRAPH_MAGIC, 8) != 0) {
+    cout << fileName << " is not a binary graph" << endl;
+    abort();
+  }
+  if (h.version != BIN_GRAPH_VERSION || h.idBytes != sizeof(intE) || h.offsetBytes != sizeof(long)) {
+    cout << fileName << ": unsupported version " << h.version << " or id width " << h.idBytes << endl;
+    abort();
+  }
+  fstat(fd, &st);
+  for (int i = 0; i < BIN_NUM_SECTIONS; i++) {
+    if (h.sections[i].offset + h.sections[i].length > (uint64_t)st.st_size) {
+      cout << fileName << " is truncated" << endl;
+      abort();
+    }
+  }
+  return h;
+}
+
+// Loads one section: into a fresh array with parallel preads, verifying
+// its checksum, or as a private mapping (mapSize != NULL), which is left
+// unverified so that only the pages touched later are read.
+void *readBinSection(int fd, binGraphHeader &h, int sec, char *fileName, long *mapSize = NULL) {
+  binSection &s = h.sections[sec];
+  if (s.length == 0) return NULL;
+  if (mapSize != NULL) {
+    void *addr = mmap(NULL, s.length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, s.offset);
+    if (addr == MAP_FAILED) {
+      cout << "Unable to map file: " << fileName << endl;
+      abort();
+    }
+    *mapSize = s.length;
+    return addr;
+  }
+  char *buf = (char *)malloc(s.length);
+  long numChunks = (s.length + BIN_IO_CHUNK - 1) / BIN_IO_CHUNK;
+  bool failed = false;
+  {parallel_for (long k = 0; k < numChunks; k++) {
+      long start = k * BIN_IO_CHUNK;
+      long end = min((long)s.length, start + BIN_IO_CHUNK);
+      while (start < end) {
+	long r = pread(fd, buf + start, end - start, s.offset + start);
+	if (r <= 0) { failed = true; break; }
+	start += r;
+      }
+    }}
+  if (failed || binChecksum(buf, s.length, 0) != s.checksum) {
+    cout << fileName << ": section " << sec << " is corrupt" << endl;
+    abort();
+  }
+  return buf;
+}
+
+// points the neighbor lists of one direction into edges
+template <class vertex>
+void setBinNeighbors(vertex *V, long n, long *offsets, intE *edges, int stride, bool in) {
+  {parallel_for (long i = 0; i < n; i++) {
+      intT d = offsets[i+1] - offsets[i];
+      if (in) {
+	V[i].setInDegree(d);
+	V[i].setInNeighbors(edges + stride * offsets[i]);
+      } else {
+	V[i].setOutDegree(d);
+	V[i].setOutNeighbors(edges + stride * offsets[i]);
+      }
+    }}
+}
+
+// Reads the sections of an open file in the versioned format into a fresh
+// vertex array. With mapped set, the edge sections are mapped instead of
+// read and their pages interleaved across the nodes; their lengths are
+// returned in mapSize and inMapSize so that del can unmap them.
+template <class vertex>
+vertex *readBinVertices(int fd, binGraphHeader &h, char *fileName, bool mapped, intE **edges, intE **inEdges, long *mapSize, long *inMapSize) {
+  const long n = h.n;
+  const int stride = (h.flags & BIN_FLAG_WEIGHTED) ? 2 : 1;
+  vertex *V = newA(vertex, n);
+  long *offsets = (long *)readBinSection(fd, h, BIN_OUT_OFFSETS, fileName);
+  *mapSize = *inMapSize = 0;
+  *edges = (intE *)readBinSection(fd, h, BIN_OUT_EDGES, fileName, mapped ? mapSize : NULL);
+  if (*mapSize > 0 && numa_num_configured_nodes() > 1)
+    numa_interleave_memory(*edges, *mapSize, numa_all_nodes_ptr);
+  setBinNeighbors(V, n, offsets, *edges, stride, false);
+  free(offsets);
+  *inEdges = NULL;
+  if (!(h.flags & BIN_FLAG_SYMMETRIC)) {
+    offsets = (long *)readBinSection(fd, h, BIN_IN_OFFSETS, fileName);
+    *inEdges = (intE *)readBinSection(fd, h, BIN_IN_EDGES, fileName, mapped ? inMapSize : NULL);
+    if (*inMapSize > 0 && numa_num_configured_nodes() > 1)
+      numa_interleave_memory(*inEdges, *inMapSize, numa_all_nodes_ptr);
+    setBinNeighbors(V, n, offsets, *inEdges, stride, true);
+    free(offsets);
+  }
+  return V;
+}
+
+int openBinGraph(char *fileName) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    cout << "Unable to open file: " << fileName << endl;
+    abort();
+  }
+  return fd;
+}
+
+// a symmetric file has no in-edge sections and an asymmetric one would
+// have its in-edges read over the out-edges, so the vertex type the app
+// picked with symmetric must match the file
+inline void checkBinSymmetry(binGraphHeader &h, char *fileName, bool symmetric) {
+  if (((h.flags & BIN_FLAG_SYMMETRIC) != 0) != symmetric) {
+    cout << fileName << " is " << (symmetric ? "asymmetric" : "symmetric")
+	 << ", load it " << (symmetric ? "without" : "with") << " -s" << endl;
+    abort();
+  }
+}
+
+// Loads a graph in the versioned format. With mapped set, the edge
+// sections are mapped instead of read; graph::del unmaps them.
+template <class vertex>
+graph<vertex> readBinGraph(char *fileName, bool symmetric, bool mapped = false) {
+  int fd = openBinGraph(fileName);
+  binGraphHeader h = readBinHeader(fd, fileName);
+  if (h.flags & BIN_FLAG_WEIGHTED) {
+    cout << fileName << " is weighted, load it as a wghGraph" << endl;
+    abort();
+  }
+  checkBinSymmetry(h, fileName, symmetric);
+  intE *edges, *inEdges;
+  long mapSize, inMapSize;
+  vertex *V = readBinVertices<vertex>(fd, h, fileName, mapped, &edges, &inEdges, &mapSize, &inMapSize);
+  close(fd);
+  cout << "n = " << h.n << " m = " << h.m << (mapped ? " (mapped)" : "") << endl;
+  graph<vertex> G(V, (intT)h.n, h.m, edges, inEdges);
+  G.allocatedMapSize = mapSize;
+  G.inEdgesMapSize = inMapSize;
+  return G;
+}
+
+// The weighted counterpart of readBinGraph. The (neighbor, weight) pairs
+// are stored interleaved, as the Wgh vertices keep them, so a mapped edge
+// section is used in place without copying.
+template <class vertex>
+wghGraph<vertex> readWghBinGraph(char *fileName, bool symmetric, bool mapped = false) {
+  int fd = openBinGraph(fileName);
+  binGraphHeader h = readBinHeader(fd, fileName);
+  if (!(h.flags & BIN_FLAG_WEIGHTED)) {
+    cout << fileName << " is not weighted, load it as a graph" << endl;
+    abort();
+  }
+  checkBinSymmetry(h, fileName, symmetric);
+  intE *edges, *inEdges;
+  long mapSize, inMapSize;
+  vertex *V = readBinVertices<vertex>(fd, h, fileName, mapped, &edges, &inEdges, &mapSize, &inMapSize);
+  close(fd);
+  cout << "n = " << h.n << " m = " << h.m << (mapped ? " (mapped)" : "") << endl;
+  wghGraph<vertex> G(V, (intT)h.n, h.m, edges, inEdges);
+  G.allocatedMapSize = mapSize;
+  G.inEdgesMapSize = inMapSize;
+  return G;
+}
+
+#endif
@@ -27,14 +27,24 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <numa.h>
 
 #include <iostream>
 #include <fstream>
 #include <stdlib.h>
 #include "parallel.h"
 #include "quickSort.h"
+#include "IO-parse.h"
+#include "transpose.h"
+#include "IO-bin.h"
 using namespace std;
 
+#ifndef PAGESIZE
+#define PAGESIZE (4096)
+#endif
+
 typedef pair<uintE,uintE> intPair;
 
 typedef pair<uintE, pair<uintE,intE> > intTriple;
@@ -59,17 +69,6 @@ words(char* C, long nn, char** S, long mm)
   void del() {free(Chars); free(Strings);}
 };
  
-inline bool isSpace(char c) {
-  switch (c)  {
-  case '\r': 
-  case '\t': 
-  case '\n': 
-  case 0:
-  case ' ' : return true;
-  default : return false;
-  }
-}
-
 _seq<char> readStringFromFile(char *fileName) {
   ifstream file (fileName, ios::in | ios::binary | ios::ate);
   if (!file.is_open()) {
@@ -109,18 +108,126 @@ words stringToWords(char *Str, long n) {
   return words(Str,n,SA,m);
 }
 
+// Builds a graph from an edge list or a Matrix Market coordinate file that
+// was read into S. The pairs are grouped into CSR with groupBySource. With
+// isSymmetric (or a symmetric .mtx) every edge is added in both directions;
+// with dedup, repeated edges and self-loops are dropped and every list is
+// sorted. Values of .mtx entries are ignored.
 template <class vertex>
-graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
-  _seq<char> S = readStringFromFile(fname);
-  words W = stringToWords(S.A, S.n);
-  if (W.Strings[0] != (string) "AdjacencyGraph") {
+graph<vertex> edgeListToGraph(_seq<char> S, bool isSymmetric, bool dedup) {
+  bool mtx = S.n >= 14 && strncmp(S.A, "%%MatrixMarket", 14) == 0;
+  bool symmetrize = isSymmetric;
+  int perEdge = 2;
+  long skip = 0, base = 0;
+  if (mtx) {
+    long e = 0;
+    while (e < S.n && S.A[e] != '\n') e++;
+    string banner(S.A, e);
+    if (banner.find("coordinate") == string::npos) {
+      cout << "Only coordinate Matrix Market files are supported" << endl;
+      abort();
+    }
+    if (banner.find("pattern") != string::npos) perEdge = 2;
+    else if (banner.find("complex") != string::npos) perEdge = 4;
+    else perEdge = 3;
+    if (banner.find("general") == string::npos) symmetrize = dedup = true;
+    skip = 3; // rows cols entries
+    base = 1;
+  }
+  blankComments(S.A, S.n);
+  tokenIndex T = indexTokens(S.A, S.n);
+  long numTokens = T.numTokens();
+  if (numTokens < skip || (numTokens - skip) % perEdge != 0 || (numTokens == skip && !mtx)) {
     cout << "Bad input file" << endl;
     abort();
   }
+  long m = (numTokens - skip) / perEdge;
+  long total = symmetrize ? 2 * m : m;
+  intE *pairs = newA(intE, 2 * total);
+  bool bad = false;
+  T.map(edgeListTokenSink(pairs, skip, perEdge, base, &bad));
+  long n = 0;
+  if (mtx) n = max(parseLong(T.nth(0)), parseLong(T.nth(1)));
+  T.del(); S.del();
+  if (bad) {
+    cout << "Bad input file" << endl;
+    abort();
+  }
+  if (m > 0) n = max(n, (long)sequence::reduce<intE>((long)0, 2 * m, maxF<intE>(), sequence::getA<intE,long>(pairs)) + 1);
 
-  long len = W.m -1;
-  long n = atol(W.Strings[1]);
-  long m = atol(W.Strings[2]);
+  if (symmetrize) {
+    {parallel_for (long p = 0; p < m; p++) {
+	pairs[2 * (m + p)] = pairs[2 * p + 1];
+	pairs[2 * (m + p) + 1] = pairs[2 * p];
+      }}
+  }
+  long *offsets = newA(long, n + 1);
+  intE *edges = groupBySource(pairs, total, n, offsets);
+  free(pairs);
+
+  if (dedup) {
+    long *degrees = newA(long, n + 1);
+    {parallel_for (long i = 0; i < n; i++) {
+	intE *ngh = edges + offsets[i];
+	long d = offsets[i + 1] - offsets[i];
+	quickSort(ngh, d, less<intE>());
+	long k = 0;
+	for (long j = 0; j < d; j++) {
+	  if (ngh[j] != i && (k == 0 || ngh[j] != ngh[k - 1])) ngh[k++] = ngh[j];
+	}
+	degrees[i] = k;
+      }}
+    degrees[n] = sequence::plusScan(degrees, degrees, n);
+    total = degrees[n];
+    intE *kept = newA(intE, total);
+    {parallel_for (long i = 0; i < n; i++) {
+	for (long j = 0; j < degrees[i + 1] - degrees[i]; j++) kept[degrees[i] + j] = edges[offsets[i] + j];
+      }}
+    free(edges);
+    free(offsets);
+    edges = kept;
+    offsets = degrees;
+  }
+
+  vertex *v = newA(vertex, n);
+  {parallel_for (long i = 0; i < n; i++) {
+      v[i].setOutDegree(offsets[i + 1] - offsets[i]);
+      v[i].setOutNeighbors(edges + offsets[i]);
+    }}
+  free(offsets);
+  cout << "n = " << n << " m = " << total << endl;
+
+  if (!isSymmetric) {
+    long mapSize = 0;
+    intE* inEdges = buildInEdges(v, n, total, mapSize);
+    graph<vertex> G(v, (intT)n, total, edges, inEdges);
+    G.inEdgesMapSize = mapSize;
+    return G;
+  }
+  return graph<vertex>(v, (intT)n, total, edges);
+}
+
+template <class vertex>
+graph<vertex> readEdgeListFromFile(char* fname, bool isSymmetric, bool dedup) {
+  return edgeListToGraph<vertex>(readStringFromFile(fname), isSymmetric, dedup);
+}
+
+template <class vertex>
+graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
+  _seq<char> S = readStringFromFile(fname);
+  tokenIndex T = indexTokens(S.A, S.n);
+  if (!tokenIs(T.nth(0), "AdjacencyGraph")) {
+    if (!looksLikeEdgeList(fname, T)) {
+      cout << "Bad input file" << endl;
+      abort();
+    }
+    T.del();
+    return edgeListToGraph<vertex>(S, isSymmetric, isSymmetric);
+  }
+
+  long len = T.numTokens() -1;
+  long n = parseLong(T.nth(1));
+  long m = parseLong(T.nth(2));
   if (len != n + m + 2) {
     cout << "Bad input file" << endl;
     abort();
@@ -129,9 +236,8 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
   intT* offsets = newA(intT,n);
   intE* edges = newA(intE,m);
 
-  {parallel_for(long i=0; i < n; i++) offsets[i] = atol(W.Strings[i + 3]);}
-  {parallel_for(long i=0; i<m; i++) edges[i] = atol(W.Strings[i+n+3]); }
-  //W.del(); // to deal with performance bug in malloc
+  T.map(adjTokenSink(offsets, edges, n));
+  T.del(); S.del();
     
   vertex* v = newA(vertex,n);
 
@@ -143,44 +249,12 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
     }}
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdges = newA(intE,m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){	  
-	temp[o+j] = make_pair(v[i].getOutNeighbor(j),i);
-      }
-      }}
     free(offsets);
-
-    quickSort(temp,m,pairFirstCmp<intE>());
- 
-    tOffsets[0] = 0; inEdges[0] = temp[0].second;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdges[i] = temp[i].second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
-
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors(inEdges+o);
-      }}    
-
-    free(tOffsets);
-    return graph<vertex>(v,(intT)n,m,edges,inEdges);
+    long mapSize = 0;
+    intE* inEdges = buildInEdges(v, n, m, mapSize);
+    graph<vertex> G(v,(intT)n,m,edges,inEdges);
+    G.inEdgesMapSize = mapSize;
+    return G;
   }
 
   else {
@@ -192,16 +266,15 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
 template <class vertex>
 wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
   _seq<char> S = readStringFromFile(fname);
-  words W = stringToWords(S.A, S.n);
-  //printf("convert over\n");
-  if (W.Strings[0] != (string) "WeightedAdjacencyGraph") {
+  tokenIndex T = indexTokens(S.A, S.n);
+  if (!tokenIs(T.nth(0), "WeightedAdjacencyGraph")) {
     cout << "Bad input file" << endl;
     abort();
   }
 
-  long len = W.m -1;
-  long n = atol(W.Strings[1]);
-  long m = atol(W.Strings[2]);
+  long len = T.numTokens() -1;
+  long n = parseLong(T.nth(1));
+  long m = parseLong(T.nth(2));
   if (len != n + 2*m + 2) {
     cout << "Bad input file" << endl;
     abort();
@@ -210,12 +283,8 @@ wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
   intT* offsets = newA(intT,n);
   intE* edgesAndWeights = newA(intE,2*m);
 
-  {parallel_for(long i=0; i < n; i++) offsets[i] = atol(W.Strings[i + 3]);}
-  {parallel_for(long i=0; i<m; i++) {
-      edgesAndWeights[2*i] = atol(W.Strings[i+n+3]); 
-      edgesAndWeights[2*i+1] = atol(W.Strings[i+n+m+3]);
-    } }
-  W.del(); // to deal with performance bug in malloc
+  T.map(wghAdjTokenSink(offsets, edgesAndWeights, n, m));
+  T.del(); S.del();
 
   vertex *v = newA(vertex,n);
 
@@ -227,47 +296,12 @@ wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
     }}
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdgesAndWghs = newA(intE,2*m);
-    intTriple* temp = newA(intTriple,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){	  
-	temp[o+j] = make_pair(v[i].getOutNeighbor(j),make_pair(i,v[i].getOutWeight(j)));
-      }
-      }}
     free(offsets);
-    quickSort(temp,m,pairFirstCmp<intPair>());
-
-    tOffsets[0] = 0; 
-    inEdgesAndWghs[0] = temp[0].second.first;
-    inEdgesAndWghs[1] = temp[0].second.second;
-    {parallel_for(long i=1;i<m;i++) {
-      inEdgesAndWghs[2*i] = temp[i].second.first; 
-      inEdgesAndWghs[2*i+1] = temp[i].second.second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    //printf("offset over\n");
-    free(temp);
-
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-    
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors((intE*)(inEdgesAndWghs+2*o));
-      }}
-
-    free(tOffsets);
-    return wghGraph<vertex>(v,(intT)n,m,edgesAndWeights, inEdgesAndWghs);
+    long mapSize = 0;
+    intE* inEdges = buildInEdges(v, n, m, mapSize, 2);
+    wghGraph<vertex> G(v,(intT)n,m,edgesAndWeights,inEdges);
+    G.inEdgesMapSize = mapSize;
+    return G;
   }
 
   else {  
@@ -276,6 +310,123 @@ wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
   }
 }
 
+// maps fileName into memory, returns NULL on failure
+void *mapGraphFile(char *fileName, long &size, bool writable) {
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) { close(fd); return NULL; }
+  size = st.st_size;
+  int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void *addr = mmap(NULL, size, prot, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return NULL;
+  return addr;
+}
+
+// Places the pages of a mapped edge array on the nodes that own their
+// source vertices. sizeArr gives the number of vertices of each node in
+// file order; without it the pages are interleaved, which is what the
+// round-robin Hash_F relabeling ends up touching anyway.
+void placeMappedEdges(void *addr, long size, long *offsets, intT n, int numOfNodes, intT *sizeArr, int sizeOfOneEdge) {
+  if (numOfNodes <= 1) return;
+  if (sizeArr == NULL) {
+    numa_interleave_memory(addr, size, numa_all_nodes_ptr);
+    return;
+  }
+  intT vStart = 0;
+  for (int i = 0; i < numOfNodes; i++) {
+    intT vEnd = vStart + sizeArr[i];
+    long startByte = (vStart < n) ? offsets[vStart] * sizeOfOneEdge : size;
+    long endByte = (vEnd < n) ? offsets[vEnd] * sizeOfOneEdge : size;
+    startByte = startByte / PAGESIZE * PAGESIZE;
+    endByte = (i == numOfNodes - 1) ? size : (endByte / PAGESIZE * PAGESIZE);
+    if (endByte > startByte)
+      numa_tonode_memory((char *)addr + startByte, endByte - startByte, i);
+    vStart = vEnd;
+  }
+}
+
+// Allocates the in-edge array with mmap and places the pages of each node's
+// share before they are written. Without node information the pages are
+// interleaved, matching the round-robin hash applied after loading.
+struct numaInEdgeAlloc {
+  int numOfNodes;
+  intT *sizeArr;
+  int stride;
+  long *mapSize;
+  numaInEdgeAlloc(int _numOfNodes, intT *_sizeArr, int _stride, long *_mapSize)
+    : numOfNodes(_numOfNodes), sizeArr(_sizeArr), stride(_stride), mapSize(_mapSize) {}
+  intE* operator() (long *tOffsets, intT n, long size) {
+    long bytes = size * sizeof(intE);
+    if (numOfNodes <= 1 || bytes == 0) return newA(intE, size);
+    void *addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) return newA(intE, size);
+    placeMappedEdges(addr, bytes, tOffsets, n, numOfNodes, sizeArr, stride * sizeof(intE));
+    *mapSize = bytes;
+    return (intE *)addr;
+  }
+};
+
+// builds the in-edges of v with the counting-sort transpose and returns the
+// in-edge array; mapSize receives its length when it was mmapped
+template <class vertex>
+intE* buildInEdges(vertex* v, intT n, uintT m, long &mapSize, int stride = 1, int numOfNodes = numa_num_configured_nodes(), intT *sizeArr = NULL) {
+  return transposeEdges(v, n, m, stride, numaInEdgeAlloc(numOfNodes, sizeArr, stride, &mapSize));
+}
+
+// Loads the transposed CSR (.iadj/.iidx) written by ConvertToBinary -t and
+// points the in-edges of v into it. With mapSize set, the .iadj file is
+// mapped and placed like the out-edges, and its length is stored in
+// *mapSize. Returns NULL if the files are missing or do not match n and m;
+// callers then fall back to buildInEdges.
+template <class vertex>
+intE* readInEdgesFromBinary(char* iFile, vertex* v, intT n, uintT m, long *mapSize = NULL, int numOfNodes = 1, intT *sizeArr = NULL) {
+  char iadjFile[strlen(iFile)+6];
+  char iidxFile[strlen(iFile)+6];
+  sprintf(iadjFile, "%s.iadj", iFile);
+  sprintf(iidxFile, "%s.iidx", iFile);
+
+  long idxSize = 0;
+  long *tOffsets = (long *)mapGraphFile(iidxFile, idxSize, false); //stored as longs
+  if (tOffsets == NULL) return NULL;
+  if (n != idxSize/sizeof(long)) {
+    cout << "Ignoring " << iidxFile << ": size wrong" << endl;
+    munmap(tOffsets, idxSize);
+    return NULL;
+  }
+
+  long size = 0;
+  uintE* inEdges = (uintE*)mapGraphFile(iadjFile, size, true); //stored as uints
+  if (inEdges == NULL || m != size/sizeof(uintE)) {
+    if (inEdges != NULL) {
+      cout << "Ignoring " << iadjFile << ": size wrong" << endl;
+      munmap(inEdges, size);
+    }
+    munmap(tOffsets, idxSize);
+    return NULL;
+  }
+  if (mapSize != NULL) {
+    placeMappedEdges(inEdges, size, tOffsets, n, numOfNodes, sizeArr, sizeof(uintE));
+    madvise(inEdges, size, MADV_WILLNEED);
+    *mapSize = size;
+  } else {
+    uintE* copy = newA(uintE,m);
+    memcpy(copy, inEdges, size);
+    munmap(inEdges, size);
+    inEdges = copy;
+  }
+
+  {parallel_for(long i=0;i<n;i++) {
+    uintT o = tOffsets[i];
+    uintT l = ((i==n-1) ? m : tOffsets[i+1])-tOffsets[i];
+    v[i].setInDegree(l);
+    v[i].setInNeighbors((intE*)inEdges+o); }}
+
+  munmap(tOffsets, idxSize);
+  return (intE*)inEdges;
+}
+
 template <class vertex>
 graph<vertex> readGraphFromBinary(char* iFile, bool isSymmetric) {
   char* config = (char*) ".config";
@@ -315,7 +466,7 @@ graph<vertex> readGraphFromBinary(char* iFile, bool isSymmetric) {
   char* t = (char *) malloc(size);
   in3.read(t,size);
   in3.close();
-  intT* offsets = (intT*) t;
+  long* offsets = (long*) t;
 
   vertex* v = newA(vertex,n);
   
@@ -328,46 +479,69 @@ graph<vertex> readGraphFromBinary(char* iFile, bool isSymmetric) {
   cout << "n = "<<n<<" m = "<<m<<endl;
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    uintE* inEdges = newA(uintE,m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){
-	temp[o+j].first = v[i].getOutNeighbor(j);
-	temp[o+j].second = i;
-      }
-      }}
+    long mapSize = 0;
+    intE* inEdges = readInEdgesFromBinary(iFile, v, n, m);
+    if(inEdges == NULL) inEdges = buildInEdges(v, n, m, mapSize);
+    free(offsets);
+    graph<vertex> G(v,(intT)n,m,(intE*)edges, inEdges);
+    G.inEdgesMapSize = mapSize;
+    return G;
+  }
+  free(offsets);
+  return graph<vertex>(v,n,m,(intE*)edges);
+}
 
-    quickSort(temp,m,pairFirstCmp<intE>());
+// Same file layout as readGraphFromBinary (.config/.adj/.idx), but the .adj
+// file is mapped and vertices point straight into the mapping, so a warm
+// page cache makes loading almost free. The mapping is private, so the
+// hashers that rewrite neighbor ids in place copy every page they touch:
+// for the NUMA apps, which relabel every edge, peak memory ends up the same
+// as readGraphFromBinary's and only the read is saved. The pages are
+// interleaved, as the partition is not known when the file is loaded.
+template <class vertex>
+graph<vertex> readGraphFromBinaryMapped(char* iFile, bool isSymmetric, int numOfNodes = 1, intT *sizeArr = NULL) {
+  char configFile[strlen(iFile)+8];
+  char adjFile[strlen(iFile)+5];
+  char idxFile[strlen(iFile)+5];
+  sprintf(configFile, "%s.config", iFile);
+  sprintf(adjFile, "%s.adj", iFile);
+  sprintf(idxFile, "%s.idx", iFile);
 
-    tOffsets[0] = 0; inEdges[0] = temp[0].second;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdges[i] = temp[i].second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
+  ifstream in(configFile, ifstream::in);
+  intT n;
+  in >> n;
+  in.close();
 
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
+  long idxSize = 0;
+  long *offsets = (long *)mapGraphFile(idxFile, idxSize, false); //stored as longs
+  if (offsets == NULL || n != idxSize/sizeof(long)) { cout << "File size wrong\n"; abort(); }
+  madvise(offsets, idxSize, MADV_SEQUENTIAL);
 
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors((intE*)inEdges+o);
-      }}
-    free(tOffsets);
-    return graph<vertex>(v,(intT)n,m,(intE*)edges, (intE*)inEdges);
+  long size = 0;
+  uintE* edges = (uintE*)mapGraphFile(adjFile, size, true); //stored as uints
+  if (edges == NULL) { cout << "Unable to map file: " << adjFile << endl; abort(); }
+  uintT m = size/sizeof(uintE);
+  placeMappedEdges(edges, size, offsets, n, numOfNodes, sizeArr, sizeof(uintE));
+  madvise(edges, size, MADV_WILLNEED);
+
+  vertex* v = newA(vertex,n);
+
+  {parallel_for(long i=0;i<n;i++) {
+    uintT o = offsets[i];
+    uintT l = ((i==n-1) ? m : offsets[i+1])-offsets[i];
+    v[i].setOutDegree(l);
+    v[i].setOutNeighbors((intE*)edges+o); }}
+
+  cout << "n = "<<n<<" m = "<<m<<" (mapped)"<<endl;
+
+  graph<vertex> G(v,n,m,(intE*)edges);
+  if(!isSymmetric) {
+    G.inEdges = readInEdgesFromBinary(iFile, v, n, m, &G.inEdgesMapSize, numOfNodes, sizeArr);
+    if(G.inEdges == NULL) G.inEdges = buildInEdges(v, n, m, G.inEdgesMapSize, 1, numOfNodes, sizeArr);
   }
-  free(offsets);
-  return graph<vertex>(v,n,m,(intE*)edges);
+  G.allocatedMapSize = size;
+  munmap(offsets, idxSize);
+  return G;
 }
 
 template <class vertex>
@@ -410,7 +584,7 @@ wghGraph<vertex> readWghGraphFromBinary(char* iFile, bool isSymmetric) {
   char* t = (char *) malloc(size);
   in3.read(t,size);
   in3.close();
-  intT* offsets = (intT*) t;
+  long* offsets = (long*) t;
 
   vertex *V = newA(vertex, n);
   intE* edgesAndWeights = newA(intE,2*m);
@@ -429,64 +603,41 @@ wghGraph<vertex> readWghGraphFromBinary(char* iFile, bool isSymmetric) {
   cout << "n = "<<n<<" m = "<<m<<endl;
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdgesAndWghs = newA(intE,2*m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<V[i].getOutDegree();j++){
-	temp[o+j] = make_pair(V[i].getOutNeighbor(j),i);
-      }
-      }}
-
-    quickSort(temp,m,pairFirstCmp<intE>());
-
-    tOffsets[0] = 0; 
-    inEdgesAndWghs[0] = temp[0].second;
-    inEdgesAndWghs[1] = 1;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdgesAndWghs[2*i] = temp[i].second;
-      inEdgesAndWghs[2*i+1] = 1;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      V[i].setInDegree(l);
-      V[i].setInNeighbors((intE*)(inEdgesAndWghs+2*o));
-      }}
-    free(tOffsets);
-    return wghGraph<vertex>(V,(intT)n,m,edges,inEdgesAndWghs);
+    free(offsets);
+    long mapSize = 0;
+    intE* inEdgesAndWghs = buildInEdges(V, n, m, mapSize, 2);
+    wghGraph<vertex> G(V,(intT)n,m,edgesAndWeights,inEdgesAndWghs);
+    G.inEdgesMapSize = mapSize;
+    return G;
   }
   free(offsets);
   return wghGraph<vertex>(V,n,m,edgesAndWeights);
 }
 
 template <class vertex>
-graph<vertex> readGraph(char* iFile, bool symmetric, bool binary) {
+graph<vertex> readGraph(char* iFile, bool symmetric, bool binary, bool mapped=false) {
+  if(mapped) return readGraphFromBinaryMapped<vertex>(iFile,symmetric,numa_num_configured_nodes());
   if(binary) return readGraphFromBinary<vertex>(iFile,symmetric); 
   else return readGraphFromFile<vertex>(iFile,symmetric);
 }
 
+// a binary iFile is either a single file in the versioned format, which
+// can be mapped, or the prefix of the .config/.adj/.idx files
 template <class vertex>
-wghGraph<vertex> readWghGraph(char* iFile, bool symmetric, bool binary) {
+wghGraph<vertex> readWghGraph(char* iFile, bool symmetric, bool binary, bool mapped=false) {
+  if((binary || mapped) && isBinGraphFile(iFile)) return readWghBinGraph<vertex>(iFile,symmetric,mapped);
   if(binary) return readWghGraphFromBinary<vertex>(iFile,symmetric); 
   else return readWghGraphFromFile<vertex>(iFile,symmetric);
 }
 
 
+// Loads a graph written by dumpGraphToBin. Files in the older interleaved
+// per-vertex layout (no magic) are still accepted.
 template <class vertex>
-graph<vertex> loadGraphFromBin(char *fileName) {
+graph<vertex> loadGraphFromBin(char *fileName, bool symmetric, bool mapped = false) {
+    if (isBinGraphFile(fileName))
+	return readBinGraph<vertex>(fileName, symmetric, mapped);
+
     int fd = open(fileName, O_RDONLY, S_IREAD);
     long long totalSize = 0;
     read(fd, (void *)&totalSize, sizeof(long long));
@@ -559,159 +710,375 @@ graph<vertex> loadGraphFromBin(char *fileName) {
     return graph<vertex>(vertices, (intT)n, m, edges);
 }
 
+// Loads a weighted graph written by dumpWghGraphToBin; with mapped set the
+// edge sections are used in place
 template <class vertex>
-wghGraph<vertex> loadWghGraphFromBin(char *fileName) {
+wghGraph<vertex> loadWghGraphFromBin(char *fileName, bool symmetric, bool mapped = false) {
+    if (!isBinGraphFile(fileName)) {
+	cout << fileName << " is not a binary graph" << endl;
+	abort();
+    }
+    return readWghBinGraph<vertex>(fileName, symmetric, mapped);
 }
 
 
 template <class vertex>
 void dumpGraphToBin(graph<vertex> &graph, char *fileName) {
-    const intT n = graph.n;
-    
-    long long totalSize = 0;
-    for (intT i = 0; i < n; i++) {
-	totalSize += 4 * sizeof(intT); // const -1, vertID, outDeg, inDeg
-	totalSize += graph.V[i].getOutDegree() * sizeof(intE);
-	totalSize += graph.V[i].getInDegree() * sizeof(intE);
-    }
-    totalSize += sizeof(intT) + sizeof(long long) * 2;
-    
-    printf("Total size is: %ld\n", totalSize);
-    
-    void *buf = (void *)malloc(totalSize);
-    
-    char *ptr = (char *)buf;
-    
-    *(long long *)ptr = totalSize;
-    ptr += sizeof(long long);
-    
-    *(intT *)ptr = n;
-    ptr += sizeof(intT);
-    
-    *(long long *)ptr = graph.m;
-    ptr += sizeof(long long);
-    
-    printf("write n & m: %d %d\n", n, graph.m);
-    
-    for (intT i = 0; i < n; i++) {
-	*(intT *)ptr = -1;
-	ptr += sizeof(intT);
-	
-	*(intT *)ptr = i;
-	ptr += sizeof(intT);
-	
-	*(intT *)ptr = graph.V[i].getOutDegree();
-	ptr += sizeof(intT);
-	
-	*(intT *)ptr = graph.V[i].getInDegree();
-	ptr += sizeof(intT);
-	
-	for (intT j = 0; j < graph.V[i].getOutDegree(); j++) {
-	    *(intE *)ptr = graph.V[i].getOutNeighbor(j);
-	    ptr += sizeof(intE);
-	}
-	
-	for (intT j = 0; j < graph.V[i].getInDegree(); j++) {
-	    *(intE *)ptr = graph.V[i].getInNeighbor(j);
-	    ptr += sizeof(intE);
-	}
-    }
-    
-    int fd = open(fileName, O_RDWR | O_CREAT, S_IWRITE | S_IREAD);
-    long long written = 0;
-    while (written < totalSize) {
-	long long sizeWritten = write(fd, (void *)((char *)buf + written), totalSize - written);
-	if (sizeWritten < 0) {
-	    printf("oops\n");
-	}	    
-	written += sizeWritten;
-	printf("wrote: %ld, accum: %ld\n", sizeWritten, written);
-    }
+    bool symmetric = (sizeof(vertex) != sizeof(asymmetricVertex));
+    writeBinGraph(graph.V, graph.n, graph.m, symmetric, false, fileName);
 }
 
-template<class vertex>
-void dumpPartitionInfo(graph<vertex> &graph, char * fileName, intT *sizeArr, int numOfNodes) {
-    int fd = open(fileName, O_RDWR | O_CREAT, S_IWRITE | S_IREAD);
-    if ((write(fd, sizeArr, sizeof(int) * numOfNodes)) < 0)
-	abort();
+template <class vertex>
+void dumpWghGraphToBin(wghGraph<vertex> &graph, char *fileName) {
+    bool symmetric = (sizeof(vertex) != sizeof(asymmetricWghVertex));
+    writeBinGraph(graph.V, graph.n, graph.m, symmetric, true, fileName);
+}
+
+// Preprocessing cache, keyed by input file, node count and cores per node:
+// [cache] is "[input].n[nodes].c[cores]". [cache].bin holds the graph after
+// graphAllEdgeHasher in the versioned binary format, and [cache].part the
+// partition: a header, the sizeArr of partitionByDegree and the sub-shard
+// sizes of every node. The .part file is written last and records the
+// size and mtime of the input, so a cache that was cut short or that
+// belongs to an older input is never used.
+#define PARTITION_CACHE_MAGIC (0x7472617079726c6fLL)
+
+struct partitionHeader {
+    long long magic;
+    long long n;
+    long long m;
+    long long inputSize;
+    long long inputMtime;
+    int numOfNodes;
+    int coresPerNode;
+    int sizeOfOneEle;
+    int pad;
+};
+
+void partitionCacheName(char *buf, char *inputFile, int numOfNodes, int coresPerNode) {
+    sprintf(buf, "%s.n%d.c%d", inputFile, numOfNodes, coresPerNode);
+}
+
+// The cache name of a run. Every partitioner setting that changes the cached
+// graph or its cuts gets a suffix, so that runs with different settings
+// never load each other's cache: order is the vertex order (0 for none),
+// balanced selects partitionByConstraints and hubThreshold, when not
+// negative, the hybrid cut. buf needs room for 64 bytes past inputFile.
+void partitionCacheKey(char *buf, char *inputFile, int numOfNodes, int coresPerNode, int order, bool balanced, int hubThreshold) {
+    partitionCacheName(buf, inputFile, numOfNodes, coresPerNode);
+    if (order != 0) sprintf(buf + strlen(buf), ".o%d", order);
+    if (balanced) sprintf(buf + strlen(buf), ".b");
+    if (hubThreshold >= 0) sprintf(buf + strlen(buf), ".h%d", hubThreshold);
+}
+
+bool statInput(char *inputFile, partitionHeader &h) {
+    struct stat st;
+    if (stat(inputFile, &st) < 0) return false;
+    h.inputSize = st.st_size;
+    h.inputMtime = st.st_mtime;
+    return true;
+}
+
+void dumpPartitionInfo(char *cacheName, char *inputFile, intT n, uintT m, intT *sizeArr, int numOfNodes, intT *subSizeArr, int coresPerNode, int sizeOfOneEle) {
+    partitionHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = PARTITION_CACHE_MAGIC;
+    h.n = n;
+    h.m = m;
+    h.numOfNodes = numOfNodes;
+    h.coresPerNode = coresPerNode;
+    h.sizeOfOneEle = sizeOfOneEle;
+    statInput(inputFile, h);
 
-    //check size arr
     intT numOfVert = 0;
     for (int i = 0; i < numOfNodes; i++) {
 	numOfVert += sizeArr[i];
+	intT subVert = 0;
+	for (int j = 0; j < coresPerNode; j++) subVert += subSizeArr[i * coresPerNode + j];
+	// the sub-shards of a node cover its whole n-sized local graph
+	if (subVert != n) {
+	    printf("size check wrong!!\n");
+	    abort();
+	}
     }
-
-    if (numOfVert != graph.n) {
+    if (numOfVert != n) {
 	printf("size check wrong!!\n");
 	abort();
     }
 
-    long long totalSize = 0;
-    for (intT i = 0; i < graph.n; i++) {
-	totalSize += 2 * sizeof(intT);
+    char name[strlen(cacheName) + 8];
+    sprintf(name, "%s.part", cacheName);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD);
+    if (fd < 0 ||
+	write(fd, &h, sizeof(h)) != sizeof(h) ||
+	write(fd, sizeArr, sizeof(intT) * numOfNodes) != (long)(sizeof(intT) * numOfNodes) ||
+	write(fd, subSizeArr, sizeof(intT) * numOfNodes * coresPerNode) != (long)(sizeof(intT) * numOfNodes * coresPerNode)) {
+	printf("unable to write %s\n", name);
+	abort();
     }
+    close(fd);
+    printf("cached partition in %s\n", name);
+}
 
-    void *buf = (void *)malloc(totalSize);
-    char *ptr = (char *)buf;
-    
-    for (intT i = 0; i < graph.n; i++) {
-	*(intT *)ptr = graph.V[i].getOutDegree();
-	ptr += sizeof(intT);
+// Fills sizeArr and subSizeArr from [cacheName].part. Returns false when
+// there is no cache for this input and configuration.
+bool loadPartitionFromFile(char *cacheName, char *inputFile, intT *sizeArr, int numOfNodes, intT *subSizeArr, int coresPerNode, int sizeOfOneEle) {
+    char name[strlen(cacheName) + 8];
+    sprintf(name, "%s.part", cacheName);
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return false;
+
+    partitionHeader h, input;
+    bool ok = read(fd, &h, sizeof(h)) == sizeof(h) && h.magic == PARTITION_CACHE_MAGIC &&
+	h.numOfNodes == numOfNodes && h.coresPerNode == coresPerNode && h.sizeOfOneEle == sizeOfOneEle;
+    if (ok && statInput(inputFile, input) && (input.inputSize != h.inputSize || input.inputMtime != h.inputMtime)) {
+	printf("%s is older than %s, rebuilding it\n", name, inputFile);
+	ok = false;
+    }
+    long sizeBytes = sizeof(intT) * numOfNodes;
+    long subBytes = sizeof(intT) * numOfNodes * coresPerNode;
+    ok = ok && read(fd, sizeArr, sizeBytes) == sizeBytes && read(fd, subSizeArr, subBytes) == subBytes;
+    close(fd);
+    return ok;
+}
 
-	*(intT *)ptr = graph.V[i].getInDegree();
-	ptr += sizeof(intT);
+// loads [cacheName].bin and restores the fake degrees graphAllEdgeHasher sets
+template <class vertex>
+graph<vertex> loadGraphCache(char *cacheName, bool symmetric, bool mapped = false) {
+    char name[strlen(cacheName) + 8];
+    sprintf(name, "%s.bin", cacheName);
+    graph<vertex> G = readBinGraph<vertex>(name, symmetric, mapped);
+    {parallel_for (intT i = 0; i < G.n; i++) G.V[i].setFakeDegree(G.V[i].getOutDegree());}
+    return G;
+}
+
+// The permutation a reordering applied to the cached graph, so that results
+// can be reported by input id: perm[input id] = cached id.
+void dumpCachePermutation(char *cacheName, intT *perm, intT n) {
+    char name[strlen(cacheName) + 8];
+    sprintf(name, "%s.perm", cacheName);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IWRITE | S_IREAD);
+    if (fd < 0 || write(fd, perm, sizeof(intT) * n) != (long)(sizeof(intT) * n)) {
+	printf("unable to write %s\n", name);
+	abort();
     }
+    close(fd);
+}
 
-    long long written = 0;
-    while (written < totalSize) {
-	long long sizeWritten = write(fd, (void *)((char *)buf + written), totalSize - written);
-	if (sizeWritten < 0) {
-	    printf("oops\n");
-	}	    
-	written += sizeWritten;
+// returns NULL when the cached graph was not reordered
+intT *loadCachePermutation(char *cacheName, intT n) {
+    char name[strlen(cacheName) + 8];
+    sprintf(name, "%s.perm", cacheName);
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return NULL;
+    intT *perm = newA(intT, n);
+    if (read(fd, perm, sizeof(intT) * n) != (long)(sizeof(intT) * n)) {
+	printf("%s is truncated\n", name);
+	abort();
     }
+    close(fd);
+    return perm;
 }
 
 template <class vertex>
-graph<vertex> loadPartitionFromFile(char *fileName, intT *sizeArr, intT numOfNodes) {
-    int fd = open(fileName, O_RDONLY, S_IREAD);
-    read(fd, (void *)sizeArr, sizeof(intT) * numOfNodes);
+void dumpGraphCache(graph<vertex> &GA, char *cacheName) {
+    char name[strlen(cacheName) + 8];
+    // a new graph invalidates the old partition until it is rewritten
+    sprintf(name, "%s.part", cacheName);
+    unlink(name);
+    sprintf(name, "%s.bin", cacheName);
+    dumpGraphToBin(GA, name);
+}
 
-    long long totalSize = 0;
-    for (int i = 0; i < numOfNodes; i++) {
-	totalSize += sizeArr[i];
-    }
+// Per-node shard files ([prefix].shard[i]). Shard i holds what
+// graphFilter2Direction returns on node i for a hashed and partitioned
+// graph: every vertex with its global degrees, and only the edges whose
+// other endpoint lies in [rangeLow, rangeHi). The file starts with this
+// header and the partition table, followed by four degrees per vertex
+// (out, in, filtered out, filtered in) and the filtered out- and in-edges.
+#define GRAPH_SHARD_MAGIC (0x64726168732d6cLL)
+
+struct graphShardHeader {
+    long long magic;
+    long long n;
+    long long m;
+    long long outEdges;
+    long long inEdges;
+    int numOfShards;
+    int shardID;
+    int rangeLow;
+    int rangeHi;
+    int sizeOfOneEle; // element size the partition was page-aligned for
+    int pad;
+};
+
+void shardFileName(char *buf, char *prefix, int shardID) {
+    sprintf(buf, "%s.shard%d", prefix, shardID);
+}
 
-    void *buf = (void *)malloc(totalSize * sizeof(intT) * 2);
-    printf("number of vert is: %ld %p\n", totalSize, buf);
+template <class vertex>
+void dumpGraphShard(graph<vertex> &GA, char *prefix, int shardID, int numOfShards, intT *sizeArr, int sizeOfOneEle) {
+    const intT n = GA.n;
+    vertex *V = GA.V;
+    int rangeLow = 0;
+    for (int i = 0; i < shardID; i++) rangeLow += sizeArr[i];
+    int rangeHi = rangeLow + sizeArr[shardID];
+
+    intT *degrees = newA(intT, 4 * (long)n);
+    {parallel_for (intT i = 0; i < n; i++) {
+	    intT outCount = 0, inCount = 0;
+	    for (intT j = 0; j < V[i].getOutDegree(); j++) {
+		intT ngh = V[i].getOutNeighbor(j);
+		if (rangeLow <= ngh && ngh < rangeHi) outCount++;
+	    }
+	    for (intT j = 0; j < V[i].getInDegree(); j++) {
+		intT ngh = V[i].getInNeighbor(j);
+		if (rangeLow <= ngh && ngh < rangeHi) inCount++;
+	    }
+	    degrees[4*(long)i] = V[i].getOutDegree();
+	    degrees[4*(long)i+1] = V[i].getInDegree();
+	    degrees[4*(long)i+2] = outCount;
+	    degrees[4*(long)i+3] = inCount;
+	}}
+
+    graphShardHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GRAPH_SHARD_MAGIC;
+    header.n = n;
+    header.m = GA.m;
+    for (intT i = 0; i < n; i++) {
+	header.outEdges += degrees[4*(long)i+2];
+	header.inEdges += degrees[4*(long)i+3];
+    }
+    header.numOfShards = numOfShards;
+    header.shardID = shardID;
+    header.rangeLow = rangeLow;
+    header.rangeHi = rangeHi;
+    header.sizeOfOneEle = sizeOfOneEle;
+
+    char fileName[strlen(prefix) + 20];
+    shardFileName(fileName, prefix, shardID);
+    FILE *fp = fopen(fileName, "wb");
+    if (fp == NULL) {
+	printf("unable to open %s\n", fileName);
+	abort();
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(sizeArr, sizeof(intT), numOfShards, fp);
+    fwrite(degrees, sizeof(intT), 4 * (long)n, fp);
+    free(degrees);
+
+    for (int dir = 0; dir < 2; dir++) {
+	for (intT i = 0; i < n; i++) {
+	    intT d = (dir == 0) ? V[i].getOutDegree() : V[i].getInDegree();
+	    for (intT j = 0; j < d; j++) {
+		intE ngh = (dir == 0) ? V[i].getOutNeighbor(j) : V[i].getInNeighbor(j);
+		if (rangeLow <= ngh && ngh < rangeHi) fwrite(&ngh, sizeof(intE), 1, fp);
+	    }
+	}
+    }
+    if (fclose(fp) != 0) {
+	printf("write to %s failed\n", fileName);
+	abort();
+    }
+    printf("shard %d: [%d, %d) out %lld in %lld\n", shardID, rangeLow, rangeHi, header.outEdges, header.inEdges);
+}
 
+void readShardFully(int fd, void *buf, long long size, char *fileName) {
     long long readSize = 0;
-    while (readSize < totalSize) {
-	long long readOnce = read(fd, (void *)((char *)buf + readSize), totalSize - readSize);
+    while (readSize < size) {
+	long long readOnce = read(fd, (char *)buf + readSize, size - readSize);
+	if (readOnce <= 0) {
+	    printf("short read on %s\n", fileName);
+	    abort();
+	}
 	readSize += readOnce;
-	printf("read %ld, accum %ld\n", readOnce, readSize);
     }
+}
 
-    const intT n = totalSize;
-    char *ptr = (char *)buf;
-
-    vertex *vertices = newA(vertex, n);
-    long long counter = 0;
-    long long inCounter = 0;
+// reads the header of shard 0, and its partition table into sizeArr unless
+// it is NULL (call with NULL first to learn numOfShards)
+graphShardHeader readGraphShardHeader(char *prefix, intT *sizeArr) {
+    char fileName[strlen(prefix) + 20];
+    shardFileName(fileName, prefix, 0);
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+	printf("unable to open %s\n", fileName);
+	abort();
+    }
+    graphShardHeader header;
+    readShardFully(fd, &header, sizeof(header), fileName);
+    if (header.magic != GRAPH_SHARD_MAGIC) {
+	printf("%s is not a graph shard\n", fileName);
+	abort();
+    }
+    if (sizeArr != NULL)
+	readShardFully(fd, sizeArr, sizeof(intT) * header.numOfShards, fileName);
+    close(fd);
+    return header;
+}
 
+// Loads shard shardID into memory local to the calling thread, giving the
+// same graph graphFilter2Direction would build on that node. Like that
+// graph it has an entry for all n vertices, since PageRank's edgeMaps index
+// the local graph by global id: only the edges are split between the
+// nodes, the vertex array stays O(n) per node.
+template <class vertex>
+graph<vertex> loadGraphShard(char *prefix, int shardID, int numOfShards) {
+    char fileName[strlen(prefix) + 20];
+    shardFileName(fileName, prefix, shardID);
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+	printf("unable to open %s\n", fileName);
+	abort();
+    }
+    graphShardHeader header;
+    readShardFully(fd, &header, sizeof(header), fileName);
+    if (header.magic != GRAPH_SHARD_MAGIC || header.shardID != shardID || header.numOfShards != numOfShards) {
+	printf("%s does not match shard %d of %d\n", fileName, shardID, numOfShards);
+	abort();
+    }
+    const intT n = header.n;
+    lseek(fd, sizeof(intT) * numOfShards, SEEK_CUR);
+
+    intT *degrees = (intT *)malloc(sizeof(intT) * 4 * (long)n);
+    readShardFully(fd, degrees, sizeof(intT) * 4 * (long)n, fileName);
+    intE *edges = (intE *)numa_alloc_local(sizeof(intE) * header.outEdges);
+    intE *inEdges = (intE *)numa_alloc_local(sizeof(intE) * header.inEdges);
+    readShardFully(fd, edges, sizeof(intE) * header.outEdges, fileName);
+    readShardFully(fd, inEdges, sizeof(intE) * header.inEdges, fileName);
+    close(fd);
+
+    vertex *newVertexSet = (vertex *)numa_alloc_local(sizeof(vertex) * n);
+    long offset = 0, inOffset = 0;
     for (intT i = 0; i < n; i++) {
-	intT outDeg = *(intT *)ptr;
-	ptr += sizeof(intT);
+	intT *d = degrees + 4*(long)i;
+	newVertexSet[i].setOutDegree(d[0]);
+	newVertexSet[i].setInDegree(d[1]);
+	newVertexSet[i].setFakeDegree(d[2]);
+	newVertexSet[i].setFakeInDegree(d[3]);
+	newVertexSet[i].setOutNeighbors(edges + offset);
+	newVertexSet[i].setInNeighbors(inEdges + inOffset);
+	offset += d[2];
+	inOffset += d[3];
+    }
+    free(degrees);
+    return graph<vertex>(newVertexSet, n, header.m);
+}
 
-	intT inDeg = *(intT *)ptr;
-	ptr += sizeof(intT);
-	
-	vertices[i].setOutDegree(outDeg);
-	vertices[i].setInDegree(inDeg);
+// releases a graph returned by loadGraphShard
+template <class vertex>
+void freeGraphShard(graph<vertex> &G) {
+    long outEdges = 0, inEdges = 0;
+    for (intT i = 0; i < G.n; i++) {
+	outEdges += G.V[i].getFakeDegree();
+	inEdges += G.V[i].getFakeInDegree();
     }
-    
-    free(buf);
-    return graph<vertex>(vertices, (intT)n, 0, NULL);
+    if (G.n > 0) {
+	numa_free(G.V[0].getOutNeighborPtr(), sizeof(intE) * outEdges);
+	numa_free(G.V[0].getInNeighborPtr(), sizeof(intE) * inEdges);
+    }
+    numa_free(G.V, sizeof(vertex) * G.n);
 }
 
 template <class vertex>
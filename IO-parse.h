@@ -0,0 +1,208 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef IO_PARSE_INCLUDED
+#define IO_PARSE_INCLUDED
+
+#include <string.h>
+#include "parallel.h"
+
+// Chunked parallel tokenizer for the text graph formats. The buffer is cut
+// into fixed-size chunks; a chunk owns every token whose first character
+// falls inside it, so no chunk boundary ever splits a token. Tokens are
+// parsed in place, without building an array of pointers to them.
+
+#define PARSE_CHUNK_SIZE (1 << 20)
+
+inline bool isSpace(char c) {
+  switch (c)  {
+  case '\r':
+  case '\t':
+  case '\n':
+  case 0:
+  case ' ' : return true;
+  default : return false;
+  }
+}
+
+inline long parseLong(char *s) {
+  bool neg = (*s == '-');
+  if (neg || *s == '+') s++;
+  long r = 0;
+  while ((unsigned)(*s - '0') < 10) r = r * 10 + (*s++ - '0');
+  return neg ? -r : r;
+}
+
+inline bool isTokenStart(char *S, long i) {
+  return !isSpace(S[i]) && (i == 0 || isSpace(S[i-1]));
+}
+
+struct tokenIndex {
+  char *S;
+  long n;
+  long numChunks;
+  long *offsets; // index of the first token of each chunk, offsets[numChunks] is the total
+
+  long numTokens() { return offsets[numChunks]; }
+
+  // calls f(i, token) for every token, chunks in parallel
+  template <class F>
+  void map(F f) {
+    {parallel_for (long k = 0; k < numChunks; k++) {
+	long s = k * PARSE_CHUNK_SIZE;
+	long e = min(s + PARSE_CHUNK_SIZE, n);
+	long t = offsets[k];
+	for (long i = s; i < e; i++) {
+	  if (isTokenStart(S, i)) f(t++, S + i);
+	}
+      }}
+  }
+
+  // pointer to the i-th token, scanning from the start; only meant for the
+  // header. Returns the terminator when there are fewer tokens.
+  char *nth(long idx) {
+    long t = 0;
+    for (long i = 0; i < n; i++) {
+      if (isTokenStart(S, i)) {
+	if (t == idx) return S + i;
+	t++;
+      }
+    }
+    return S + n;
+  }
+
+  void del() { free(offsets); }
+};
+
+// S must have room for a terminator at S[n]
+tokenIndex indexTokens(char *S, long n) {
+  tokenIndex T;
+  S[n] = 0;
+  T.S = S;
+  T.n = n;
+  T.numChunks = (n + PARSE_CHUNK_SIZE - 1) / PARSE_CHUNK_SIZE;
+  T.offsets = newA(long, T.numChunks + 1);
+  {parallel_for (long k = 0; k < T.numChunks; k++) {
+      long s = k * PARSE_CHUNK_SIZE;
+      long e = min(s + PARSE_CHUNK_SIZE, n);
+      long c = 0;
+      for (long i = s; i < e; i++) c += isTokenStart(S, i);
+      T.offsets[k] = c;
+    }}
+  T.offsets[T.numChunks] = sequence::plusScan(T.offsets, T.offsets, T.numChunks);
+  return T;
+}
+
+inline bool tokenIs(char *tok, const char *word) {
+  long l = strlen(word);
+  return strncmp(tok, word, l) == 0 && isSpace(tok[l]);
+}
+
+// AdjacencyGraph: tokens 3..n+2 are offsets, the remaining m are edges
+struct adjTokenSink {
+  intT *offsets;
+  intE *edges;
+  long n;
+  adjTokenSink(intT *_offsets, intE *_edges, long _n) : offsets(_offsets), edges(_edges), n(_n) {}
+  inline void operator() (long i, char *tok) {
+    if (i < 3) return;
+    if (i < n + 3) offsets[i - 3] = parseLong(tok);
+    else edges[i - n - 3] = parseLong(tok);
+  }
+};
+
+// WeightedAdjacencyGraph: offsets, then m edges, then m weights, stored
+// interleaved as (edge, weight) pairs
+struct wghAdjTokenSink {
+  intT *offsets;
+  intE *edgesAndWeights;
+  long n;
+  long m;
+  wghAdjTokenSink(intT *_offsets, intE *_ew, long _n, long _m) : offsets(_offsets), edgesAndWeights(_ew), n(_n), m(_m) {}
+  inline void operator() (long i, char *tok) {
+    if (i < 3) return;
+    if (i < n + 3) offsets[i - 3] = parseLong(tok);
+    else if (i < n + m + 3) edgesAndWeights[2 * (i - n - 3)] = parseLong(tok);
+    else edgesAndWeights[2 * (i - n - m - 3) + 1] = parseLong(tok);
+  }
+};
+
+// Edge lists: one "src dst" pair per line, as written by SNAP ('#'
+// comments) or in Matrix Market coordinate files ('%' comments, 1-based
+// ids, a "rows cols entries" size line and possibly a value per entry).
+
+// blanks every line starting with '#' or '%'; each comment is cleared by
+// the task that finds its first character
+void blankComments(char *S, long n) {
+  {parallel_for (long i = 0; i < n; i++) {
+      if ((S[i] == '#' || S[i] == '%') && (i == 0 || S[i-1] == '\n')) {
+	for (long j = i; j < n && S[j] != '\n'; j++) S[j] = ' ';
+      }
+    }}
+}
+
+inline bool isNumber(char *tok) {
+  if (*tok == '-' || *tok == '+') tok++;
+  return (unsigned)(*tok - '0') < 10;
+}
+
+inline bool hasSuffix(const char *s, const char *suffix) {
+  long n = strlen(s), l = strlen(suffix);
+  return n >= l && strcmp(s + n - l, suffix) == 0;
+}
+
+// whether a file that is not headed by a graph type is an edge list: it has
+// an edge-list extension, a Matrix Market banner, or starts with a vertex
+// id or a '#' comment
+inline bool looksLikeEdgeList(char *fname, tokenIndex &T) {
+  if (hasSuffix(fname, ".el") || hasSuffix(fname, ".txt") || hasSuffix(fname, ".mtx"))
+    return true;
+  char *tok = T.nth(0);
+  return strncmp(tok, "%%MatrixMarket", 14) == 0 || *tok == '#' || isNumber(tok);
+}
+
+// tokens after the first skip come in groups of perEdge; the first two of
+// each group are the endpoints, stored as (src, dst) pairs less base
+struct edgeListTokenSink {
+  intE *pairs;
+  long skip;
+  int perEdge;
+  long base;
+  bool *bad;
+  edgeListTokenSink(intE *_pairs, long _skip, int _perEdge, long _base, bool *_bad)
+    : pairs(_pairs), skip(_skip), perEdge(_perEdge), base(_base), bad(_bad) {}
+  inline void operator() (long i, char *tok) {
+    if (i < skip) return;
+    long e = (i - skip) / perEdge;
+    int c = (i - skip) % perEdge;
+    if (c >= 2) return;
+    if (!isNumber(tok)) *bad = true;
+    long v = parseLong(tok) - base;
+    if (v < 0) *bad = true;
+    pairs[2 * e + c] = v;
+  }
+};
+
+#endif
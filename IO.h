@@ -27,6 +27,9 @@
 #include <stdlib.h>
 #include "parallel.h"
 #include "quickSort.h"
+#include "IO-parse.h"
+#include "transpose.h"
+#include "IO-bin.h"
 using namespace std;
 
 typedef pair<uintE,uintE> intPair;
@@ -53,17 +56,6 @@ words(char* C, long nn, char** S, long mm)
   void del() {free(Chars); free(Strings);}
 };
  
-inline bool isSpace(char c) {
-  switch (c)  {
-  case '\r': 
-  case '\t': 
-  case '\n': 
-  case 0:
-  case ' ' : return true;
-  default : return false;
-  }
-}
-
 _seq<char> readStringFromFile(char *fileName) {
   ifstream file (fileName, ios::in | ios::binary | ios::ate);
   if (!file.is_open()) {
@@ -106,15 +98,15 @@ words stringToWords(char *Str, long n) {
 template <class vertex>
 graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
   _seq<char> S = readStringFromFile(fname);
-  words W = stringToWords(S.A, S.n);
-  if (W.Strings[0] != (string) "AdjacencyGraph") {
+  tokenIndex T = indexTokens(S.A, S.n);
+  if (!tokenIs(T.nth(0), "AdjacencyGraph")) {
     cout << "Bad input file" << endl;
     abort();
   }
 
-  long len = W.m -1;
-  long n = atol(W.Strings[1]);
-  long m = atol(W.Strings[2]);
+  long len = T.numTokens() -1;
+  long n = parseLong(T.nth(1));
+  long m = parseLong(T.nth(2));
   if (len != n + m + 2) {
     cout << "Bad input file" << endl;
     abort();
@@ -123,9 +115,8 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
   intT* offsets = newA(intT,n);
   intE* edges = newA(intE,m);
 
-  {parallel_for(long i=0; i < n; i++) offsets[i] = atol(W.Strings[i + 3]);}
-  {parallel_for(long i=0; i<m; i++) edges[i] = atol(W.Strings[i+n+3]); }
-  //W.del(); // to deal with performance bug in malloc
+  T.map(adjTokenSink(offsets, edges, n));
+  T.del(); S.del();
     
   vertex* v = newA(vertex,n);
 
@@ -137,43 +128,8 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
     }}
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdges = newA(intE,m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){	  
-	temp[o+j] = make_pair(v[i].getOutNeighbor(j),i);
-      }
-      }}
     free(offsets);
-
-    quickSort(temp,m,pairFirstCmp<intE>());
- 
-    tOffsets[0] = 0; inEdges[0] = temp[0].second;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdges[i] = temp[i].second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
-
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors(inEdges+o);
-      }}    
-
-    free(tOffsets);
+    intE* inEdges = transposeEdges(v, n, m, 1, newInEdgeAlloc());
     return graph<vertex>(v,(intT)n,m,edges,inEdges);
   }
 
@@ -186,16 +142,15 @@ graph<vertex> readGraphFromFile(char* fname, bool isSymmetric) {
 template <class vertex>
 wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
   _seq<char> S = readStringFromFile(fname);
-  words W = stringToWords(S.A, S.n);
-  //printf("convert over\n");
-  if (W.Strings[0] != (string) "WeightedAdjacencyGraph") {
+  tokenIndex T = indexTokens(S.A, S.n);
+  if (!tokenIs(T.nth(0), "WeightedAdjacencyGraph")) {
     cout << "Bad input file" << endl;
     abort();
   }
 
-  long len = W.m -1;
-  long n = atol(W.Strings[1]);
-  long m = atol(W.Strings[2]);
+  long len = T.numTokens() -1;
+  long n = parseLong(T.nth(1));
+  long m = parseLong(T.nth(2));
   if (len != n + 2*m + 2) {
     cout << "Bad input file" << endl;
     abort();
@@ -204,12 +159,8 @@ wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
   intT* offsets = newA(intT,n);
   intE* edgesAndWeights = newA(intE,2*m);
 
-  {parallel_for(long i=0; i < n; i++) offsets[i] = atol(W.Strings[i + 3]);}
-  {parallel_for(long i=0; i<m; i++) {
-      edgesAndWeights[2*i] = atol(W.Strings[i+n+3]); 
-      edgesAndWeights[2*i+1] = atol(W.Strings[i+n+m+3]);
-    } }
-  //W.del(); // to deal with performance bug in malloc
+  T.map(wghAdjTokenSink(offsets, edgesAndWeights, n, m));
+  T.del(); S.del();
 
   vertex *v = newA(vertex,n);
 
@@ -221,46 +172,8 @@ wghGraph<vertex> readWghGraphFromFile(char* fname, bool isSymmetric) {
     }}
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdgesAndWghs = newA(intE,2*m);
-    intTriple* temp = newA(intTriple,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){	  
-	temp[o+j] = make_pair(v[i].getOutNeighbor(j),make_pair(i,v[i].getOutWeight(j)));
-      }
-      }}
     free(offsets);
-    quickSort(temp,m,pairFirstCmp<intPair>());
-
-    tOffsets[0] = 0; 
-    inEdgesAndWghs[0] = temp[0].second.first;
-    inEdgesAndWghs[1] = temp[0].second.second;
-    {parallel_for(long i=1;i<m;i++) {
-      inEdgesAndWghs[2*i] = temp[i].second.first; 
-      inEdgesAndWghs[2*i+1] = temp[i].second.second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    //printf("offset over\n");
-    free(temp);
-
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-    
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors((intE*)(inEdgesAndWghs+2*o));
-      }}
-
-    free(tOffsets);
+    intE* inEdgesAndWghs = transposeEdges(v, n, m, 2, newInEdgeAlloc());
     return wghGraph<vertex>(v,(intT)n,m,edgesAndWeights, inEdgesAndWghs);
   }
 
@@ -309,7 +222,7 @@ graph<vertex> readGraphFromBinary(char* iFile, bool isSymmetric) {
   char* t = (char *) malloc(size);
   in3.read(t,size);
   in3.close();
-  intT* offsets = (intT*) t;
+  long* offsets = (long*) t;
 
   vertex* v = newA(vertex,n);
   
@@ -322,43 +235,9 @@ graph<vertex> readGraphFromBinary(char* iFile, bool isSymmetric) {
   cout << "n = "<<n<<" m = "<<m<<endl;
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    uintE* inEdges = newA(uintE,m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<v[i].getOutDegree();j++){
-	temp[o+j].first = v[i].getOutNeighbor(j);
-	temp[o+j].second = i;
-      }
-      }}
-
-    quickSort(temp,m,pairFirstCmp<intE>());
-
-    tOffsets[0] = 0; inEdges[0] = temp[0].second;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdges[i] = temp[i].second;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
-
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      v[i].setInDegree(l);
-      v[i].setInNeighbors((intE*)inEdges+o);
-      }}
-    free(tOffsets);
-    return graph<vertex>(v,(intT)n,m,(intE*)edges, (intE*)inEdges);
+    free(offsets);
+    intE* inEdges = transposeEdges(v, n, m, 1, newInEdgeAlloc());
+    return graph<vertex>(v,(intT)n,m,(intE*)edges, inEdges);
   }
   free(offsets);
   return graph<vertex>(v,n,m,(intE*)edges);
@@ -404,7 +283,7 @@ wghGraph<vertex> readWghGraphFromBinary(char* iFile, bool isSymmetric) {
   char* t = (char *) malloc(size);
   in3.read(t,size);
   in3.close();
-  intT* offsets = (intT*) t;
+  long* offsets = (long*) t;
 
   vertex *V = newA(vertex, n);
   intE* edgesAndWeights = newA(intE,2*m);
@@ -423,44 +302,9 @@ wghGraph<vertex> readWghGraphFromBinary(char* iFile, bool isSymmetric) {
   cout << "n = "<<n<<" m = "<<m<<endl;
 
   if(!isSymmetric) {
-    intT* tOffsets = newA(intT,n);
-    {parallel_for(intT i=0;i<n;i++) tOffsets[i] = INT_T_MAX;}
-    intE* inEdgesAndWghs = newA(intE,2*m);
-    intPair* temp = newA(intPair,m);
-    {parallel_for(intT i=0;i<n;i++){
-      uintT o = offsets[i];
-      for(intT j=0;j<V[i].getOutDegree();j++){
-	temp[o+j] = make_pair(V[i].getOutNeighbor(j),i);
-      }
-      }}
-
-    quickSort(temp,m,pairFirstCmp<intE>());
-
-    tOffsets[0] = 0; 
-    inEdgesAndWghs[0] = temp[0].second;
-    inEdgesAndWghs[1] = 1;
-    {parallel_for(intT i=1;i<m;i++) {
-      inEdgesAndWghs[2*i] = temp[i].second;
-      inEdgesAndWghs[2*i+1] = 1;
-      if(temp[i].first != temp[i-1].first) {
-	tOffsets[temp[i].first] = i;
-      }
-      }}
-    free(temp);
-    uintT currOffset = m;
-    for(intT i=n-1;i>=0;i--) {
-      if(tOffsets[i] == INT_T_MAX) tOffsets[i] = currOffset;
-      else currOffset = tOffsets[i];
-    }
-
-    {parallel_for(uintT i=0;i<n;i++){
-      uintT o = tOffsets[i];
-      uintT l = ((i == n-1) ? m : tOffsets[i+1])-tOffsets[i];
-      V[i].setInDegree(l);
-      V[i].setInNeighbors((intE*)(inEdgesAndWghs+2*o));
-      }}
-    free(tOffsets);
-    return wghGraph<vertex>(V,(intT)n,m,edges,inEdgesAndWghs);
+    free(offsets);
+    intE* inEdgesAndWghs = transposeEdges(V, n, m, 2, newInEdgeAlloc());
+    return wghGraph<vertex>(V,(intT)n,m,edgesAndWeights,inEdgesAndWghs);
   }
   free(offsets);
   return wghGraph<vertex>(V,n,m,edgesAndWeights);
@@ -472,8 +316,11 @@ graph<vertex> readGraph(char* iFile, bool symmetric, bool binary) {
   else return readGraphFromFile<vertex>(iFile,symmetric);
 }
 
+// a binary iFile is either a single file in the versioned format, which
+// can be mapped, or the prefix of the .config/.adj/.idx files
 template <class vertex>
-wghGraph<vertex> readWghGraph(char* iFile, bool symmetric, bool binary) {
+wghGraph<vertex> readWghGraph(char* iFile, bool symmetric, bool binary, bool mapped=false) {
+  if((binary || mapped) && isBinGraphFile(iFile)) return readWghBinGraph<vertex>(iFile,symmetric,mapped);
   if(binary) return readWghGraphFromBinary<vertex>(iFile,symmetric); 
   else return readWghGraphFromFile<vertex>(iFile,symmetric);
 }
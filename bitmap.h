@@ -0,0 +1,242 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef BITMAP_INCLUDED
+#define BITMAP_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <numa.h>
+#include "parallel.h"
+
+// Bit-packed dense frontiers: one bit per vertex instead of the byte of a
+// bool array, so clearing, counting and scanning a frontier moves an
+// eighth of the memory and a remote node's frontier spans an eighth of
+// the cache lines. Bits are set with word-level atomics, since the
+// subworkers' ranges need not be word aligned; counting uses popcount and
+// packing to a sparse list walks the set bits with ctz.
+//
+// A bitmap may also carry a summary, a second bitmap with one bit per word
+// of the first: one summary word then covers BITMAP_SUMMARY_SPAN vertices.
+// A summary bit is set along with any bit of its word and only cleared
+// when the bitmap is cleared, so a clear summary bit means an empty word
+// and scans, counts and clears skip such words without loading them.
+
+#define BITMAP_WORD_BITS (64)
+#define BITMAP_PACK_BLOCK (1024) // words per task when packing
+#define BITMAP_SUMMARY_SPAN (BITMAP_WORD_BITS * BITMAP_WORD_BITS)
+
+inline long bitmapWords(long n) {
+    return (n + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+}
+
+inline bool bitmapGet(uint64_t *w, long i) {
+    return (w[i / BITMAP_WORD_BITS] >> (i % BITMAP_WORD_BITS)) & 1;
+}
+
+inline void bitmapSet(uint64_t *w, long i, bool val) {
+    uint64_t mask = (uint64_t)1 << (i % BITMAP_WORD_BITS);
+    uint64_t *word = &w[i / BITMAP_WORD_BITS];
+    // skip the atomic when the bit already holds val
+    if (((*word & mask) != 0) == val) return;
+    if (val) __sync_fetch_and_or(word, mask);
+    else __sync_fetch_and_and(word, ~mask);
+}
+
+// the bits of word k that fall in [lo, hi)
+inline uint64_t bitmapWordIn(uint64_t *w, long k, long lo, long hi) {
+    uint64_t word = w[k];
+    long first = k * BITMAP_WORD_BITS;
+    if (lo > first) word &= ~(uint64_t)0 << (lo - first);
+    if (hi < first + BITMAP_WORD_BITS) word &= ((uint64_t)1 << (hi - first)) - 1;
+    return word;
+}
+
+template <class F>
+inline void bitmapWordForEach(uint64_t word, long k, F &f) {
+    while (word) {
+	f(k * BITMAP_WORD_BITS + __builtin_ctzll(word));
+	word &= word - 1;
+    }
+}
+
+template <class F>
+struct bitmapSummaryCall {
+    uint64_t *w;
+    long lo;
+    long hi;
+    F &f;
+    bitmapSummaryCall(uint64_t *_w, long _lo, long _hi, F &_f) : w(_w), lo(_lo), hi(_hi), f(_f) {}
+    inline void operator() (long k) { bitmapWordForEach(bitmapWordIn(w, k, lo, hi), k, f); }
+};
+
+// calls f(i) for every set bit i in [lo, hi), in order; with a summary
+// only the words whose summary bit is set are visited
+template <class F>
+inline void bitmapForEach(uint64_t *w, long lo, long hi, F &f, uint64_t *summary = NULL) {
+    if (lo >= hi) return;
+    long first = lo / BITMAP_WORD_BITS;
+    long last = (hi - 1) / BITMAP_WORD_BITS;
+    if (summary != NULL) {
+	bitmapSummaryCall<F> call(w, lo, hi, f);
+	for (long j = first / BITMAP_WORD_BITS; j <= last / BITMAP_WORD_BITS; j++)
+	    bitmapWordForEach(bitmapWordIn(summary, j, first, last + 1), j, call);
+	return;
+    }
+    for (long k = first; k <= last; k++)
+	bitmapWordForEach(bitmapWordIn(w, k, lo, hi), k, f);
+}
+
+struct bitmapPopcount {
+    uint64_t *w;
+    long lo;
+    long hi;
+    long c;
+    bitmapPopcount(uint64_t *_w, long _lo, long _hi) : w(_w), lo(_lo), hi(_hi), c(0) {}
+    inline void operator() (long k) { c += __builtin_popcountll(bitmapWordIn(w, k, lo, hi)); }
+};
+
+inline long bitmapCount(uint64_t *w, long lo, long hi, uint64_t *summary = NULL) {
+    if (lo >= hi) return 0;
+    long first = lo / BITMAP_WORD_BITS;
+    long last = (hi - 1) / BITMAP_WORD_BITS;
+    bitmapPopcount count(w, lo, hi);
+    if (summary != NULL)
+	bitmapForEach(summary, first, last + 1, count);
+    else
+	for (long k = first; k <= last; k++) count(k);
+    return count.c;
+}
+
+// sets bit i of w and the summary bit of its word
+inline void bitmapSetSummarized(uint64_t *w, uint64_t *summary, long i) {
+    bitmapSet(w, i, true);
+    bitmapSet(summary, i / BITMAP_WORD_BITS, true);
+}
+
+// the summary word covering bit i; 0 means no bit of its span is set
+inline uint64_t bitmapSummaryWord(uint64_t *summary, long i) {
+    return summary[i / BITMAP_SUMMARY_SPAN];
+}
+
+// clears words [lo, hi); callers split the bitmap by words so that no two
+// threads store to the same word
+inline void bitmapClearWords(uint64_t *w, long lo, long hi) {
+    for (long k = lo; k < hi; k++) w[k] = 0;
+}
+
+struct bitmapWordClear {
+    uint64_t *w;
+    bitmapWordClear(uint64_t *_w) : w(_w) {}
+    inline void operator() (long k) { w[k] = 0; }
+};
+
+// clears summary words [lo, hi) and the words of w they mark
+inline void bitmapClearSummarized(uint64_t *w, uint64_t *summary, long lo, long hi) {
+    bitmapWordClear clear(w);
+    for (long j = lo; j < hi; j++) {
+	if (summary[j] == 0) continue;
+	bitmapWordForEach(summary[j], j, clear);
+	summary[j] = 0;
+    }
+}
+
+inline long bitmapSummaryWords(long n) {
+    return bitmapWords(bitmapWords(n));
+}
+
+// the summary of an n-bit bitmap, in the memory of the calling thread's node
+inline uint64_t *newBitmapSummary(uint64_t *w, long n) {
+    long words = bitmapWords(n);
+    long summaryWords = bitmapWords(words);
+    uint64_t *s = (uint64_t *)numa_alloc_local(sizeof(uint64_t) * (summaryWords + 1));
+    for (long j = 0; j < summaryWords; j++) s[j] = 0;
+    for (long k = 0; k < words; k++)
+	if (w[k] != 0) s[k / BITMAP_WORD_BITS] |= (uint64_t)1 << (k % BITMAP_WORD_BITS);
+    return s;
+}
+
+// an n-bit bitmap in the memory of the calling thread's node, with every
+// bit set to val; bits past n stay clear
+inline uint64_t *newLocalBitmap(long n, bool val) {
+    long words = bitmapWords(n);
+    uint64_t *w = (uint64_t *)numa_alloc_local(sizeof(uint64_t) * (words + 1));
+    for (long k = 0; k < words; k++) w[k] = val ? ~(uint64_t)0 : 0;
+    if (val && n % BITMAP_WORD_BITS != 0)
+	w[words - 1] = ((uint64_t)1 << (n % BITMAP_WORD_BITS)) - 1;
+    return w;
+}
+
+struct bitmapAppend {
+    intT *out;
+    intT offset;
+    bitmapAppend(intT *_out, intT _offset) : out(_out), offset(_offset) {}
+    inline void operator() (long i) { *out++ = i + offset; }
+};
+
+// hands out the lists of the packers below with newA; the caller frees them
+struct mallocIntAlloc {
+    inline intT *operator() (long count) { return newA(intT, count); }
+};
+
+// the positions of the set bits of an n-bit bitmap plus offset, ascending,
+// in an array of m + 1 entries drawn from alloc; m receives their number
+template <class Alloc>
+inline intT *bitmapPack(uint64_t *w, long n, intT offset, intT *m, uint64_t *summary, Alloc alloc) {
+    long words = bitmapWords(n);
+    long blocks = (words + BITMAP_PACK_BLOCK - 1) / BITMAP_PACK_BLOCK;
+    intT *counts = newA(intT, blocks + 1);
+    {parallel_for (long b = 0; b < blocks; b++) {
+	    counts[b] = bitmapCount(w, b * BITMAP_PACK_BLOCK * BITMAP_WORD_BITS,
+				    min(n, (b + 1) * BITMAP_PACK_BLOCK * BITMAP_WORD_BITS), summary);
+	}}
+    *m = sequence::plusScan(counts, counts, (intT)blocks);
+    intT *s = alloc((long)*m + 1);
+    {parallel_for (long b = 0; b < blocks; b++) {
+	    bitmapAppend f(s + counts[b], offset);
+	    bitmapForEach(w, b * BITMAP_PACK_BLOCK * BITMAP_WORD_BITS,
+			  min(n, (b + 1) * BITMAP_PACK_BLOCK * BITMAP_WORD_BITS), f, summary);
+	}}
+    free(counts);
+    return s;
+}
+
+struct flagIndexF {
+    intT offset;
+    flagIndexF(intT _offset) : offset(_offset) {}
+    inline intT operator() (intT i) { return i + offset; }
+};
+
+// the bool-array counterpart of bitmapPack: the positions of the set flags
+// of Fl plus offset, ascending, in an array drawn from alloc
+template <class Alloc>
+inline _seq<intT> flagsPack(bool *Fl, intT n, intT offset, Alloc alloc) {
+    intT m = sequence::sum(Fl, n);
+    intT *s = alloc((long)m + 1);
+    sequence::pack(s, Fl, (intT)0, n, flagIndexF(offset));
+    return _seq<intT>(s, m);
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef DIRECTION_INCLUDED
+#define DIRECTION_INCLUDED
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <algorithm>
+#include "parallel.h"
+
+// Direction optimization after Beamer et al. (SC'12), decided per node.
+// An edgeMap normally runs dense when the frontier's vertices and
+// out-edges reach an app-supplied threshold. With a Direction_Optimizer
+// every node instead picks its own mode from its share of the work:
+//
+//   mf, the frontier out-edges expected in the node's local graph (the
+//       global frontier edges times the node's share of all edges),
+//   mu, the local edges not yet traversed, decreased by mf every round,
+//   nf, the active vertices, and whether they grew since the last round.
+//
+// A sparse node goes dense once mf > mu / alpha while the frontier is
+// growing; a dense node goes back to sparse once nf < n / beta and the
+// frontier is shrinking. When
+// calibrating, the first DIRECTION_CALIBRATION rounds in each mode are
+// timed, as seconds per unit of mf in sparse rounds and per unit of mu in
+// dense ones, and alpha is set to the ratio of the two: the frontier size
+// at which both modes are expected to take the same time.
+//
+// Nodes may disagree. The frontiers are then kept both as bits and as
+// lists for the round, see prepareModes in vertices.
+
+#define DIRECTION_ALPHA (15.0)
+#define DIRECTION_BETA (18.0)
+#define DIRECTION_CALIBRATION (3)
+
+struct Direction_Optimizer {
+    int node;
+    char *modes;       // this round's mode of every node, 1 for dense; shared
+    long localEdges;   // edges of the node's local graph
+    long totalEdges;
+    double unexplored; // estimate of mu
+    intT prevActive;
+    double alpha;
+    double beta;
+    bool calibrate;
+    double cost[2];    // seconds per unit of work in sparse and dense rounds
+    int samples[2];    // rounds timed in each mode
+    int rounds[2];     // rounds run in each mode
+    double units;      // work of the round being timed
+    double roundStart;
+
+    Direction_Optimizer(int _node, char *_modes, long _localEdges, long _totalEdges, bool _calibrate) :
+	node(_node), modes(_modes), localEdges(_localEdges), totalEdges(_totalEdges),
+	unexplored(_localEdges), prevActive(0), alpha(DIRECTION_ALPHA), beta(DIRECTION_BETA),
+	calibrate(_calibrate), units(0), roundStart(0) {
+	modes[node] = 0;
+	for (int i = 0; i < 2; i++) {
+	    cost[i] = 0;
+	    samples[i] = 0;
+	    rounds[i] = 0;
+	}
+    }
+
+    static double now() {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1000000.0;
+    }
+
+    // submaster only, before the round; n is the number of vertices
+    void decide(intT active, long frontierEdges, intT n) {
+	double mf = (totalEdges > 0) ? (double)frontierEdges * localEdges / totalEdges : 0;
+	bool growing = active > prevActive;
+	bool dense;
+	if (modes[node])
+	    dense = !(active < n / beta && !growing);
+	else
+	    dense = growing && mf > unexplored / alpha;
+	units = dense ? unexplored : mf;
+	unexplored = std::max(0.0, unexplored - mf);
+	prevActive = active;
+	modes[node] = dense;
+	rounds[dense]++;
+    }
+
+    void startRound() {
+	roundStart = now();
+    }
+
+    // submaster only, once the node's subworkers are done with the round
+    void endRound() {
+	int d = modes[node];
+	if (!calibrate || samples[d] >= DIRECTION_CALIBRATION || units < 1)
+	    return;
+	double c = (now() - roundStart) / units;
+	cost[d] = (cost[d] * samples[d] + c) / (samples[d] + 1);
+	samples[d]++;
+	if (cost[0] > 0 && cost[1] > 0)
+	    alpha = std::min(1000.0, std::max(1.0, cost[0] / cost[1]));
+    }
+};
+
+// Prints how many rounds each node ran in each mode and the alpha it
+// ended with. directions holds one entry per node.
+void reportDirections(Direction_Optimizer **directions, int numOfNodes) {
+    for (int k = 0; k < numOfNodes; k++) {
+	Direction_Optimizer *d = directions[k];
+	printf("node %d: %d sparse and %d dense rounds, alpha %.2f%s\n", k,
+	       d->rounds[0], d->rounds[1], d->alpha,
+	       (d->samples[0] > 0 && d->samples[1] > 0) ? " (calibrated)" : "");
+    }
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef FRONTIER_ARENA_INCLUDED
+#define FRONTIER_ARENA_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <numa.h>
+#include "parallel.h"
+
+// Scratch memory of the frontiers. A frontierArena hands out buffers by
+// bumping a pointer through slabs taken from numa_alloc_onnode, so they
+// sit on the frontier's node whatever the heap did before, and takes them
+// all back at once on reset(). A LocalFrontier resets its arenas in
+// clearFrontier, when switchFrontier recycles it as the next output, so a
+// buffer lives as long as the frontier it was drawn for. Slabs are kept
+// across resets: once they hold an iteration's worth of buffers, later
+// iterations allocate nothing.
+
+#define ARENA_SLAB_MIN (1 << 20)
+#define ARENA_ALIGN (64)
+
+struct arenaSlab {
+    char *base;
+    size_t size;
+    arenaSlab *prev;
+};
+
+struct frontierArena {
+    int node;
+    arenaSlab *slab;  // the one being bumped; older ones live until reset
+    size_t used;
+    size_t demand;    // bytes handed out since the last reset
+
+    frontierArena(int _node = 0) : node(_node), slab(NULL), used(0), demand(0) {}
+
+    void *alloc(size_t bytes) {
+	bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	demand += bytes;
+	if (slab == NULL || used + bytes > slab->size)
+	    addSlab(bytes);
+	void *p = slab->base + used;
+	used += bytes;
+	return p;
+    }
+
+    void addSlab(size_t bytes) {
+	size_t size = (slab != NULL) ? 2 * slab->size : ARENA_SLAB_MIN;
+	if (size < bytes) size = bytes;
+	arenaSlab *s = (arenaSlab *)malloc(sizeof(arenaSlab));
+	s->base = (char *)numa_alloc_onnode(size, node);
+	if (s->base == NULL) {
+	    printf("arena: cannot allocate %ld bytes on node %d\n", (long)size, node);
+	    abort();
+	}
+	s->size = size;
+	s->prev = slab;
+	slab = s;
+	used = 0;
+    }
+
+    void freeSlabs() {
+	while (slab != NULL) {
+	    arenaSlab *prev = slab->prev;
+	    numa_free(slab->base, slab->size);
+	    free(slab);
+	    slab = prev;
+	}
+    }
+
+    // drops every buffer; slabs outgrown during the last round are merged
+    // into one that fits all of its buffers
+    void reset() {
+	if (slab != NULL && slab->prev != NULL) {
+	    size_t last = demand;
+	    freeSlabs();
+	    addSlab(last);
+	}
+	used = 0;
+	demand = 0;
+    }
+};
+
+// the node of the calling thread, which the node threads are bound to
+inline int arenaLocalNode() {
+    int cpu = sched_getcpu();
+    int node = (cpu < 0) ? -1 : numa_node_of_cpu(cpu);
+    return (node < 0) ? 0 : node;
+}
+
+// hands out the lists of the packers in bitmap.h from an arena
+struct arenaIntAlloc {
+    frontierArena *arena;
+    arenaIntAlloc(frontierArena *_arena) : arena(_arena) {}
+    inline intT *operator() (long count) { return (intT *)arena->alloc(sizeof(intT) * count); }
+};
+
+inline frontierArena *newFrontierArenas(int count, int node) {
+    frontierArena *A = (frontierArena *)malloc(sizeof(frontierArena) * count);
+    for (int i = 0; i < count; i++) A[i] = frontierArena(node);
+    return A;
+}
+
+#endif
@@ -1,9 +1,71 @@
 #include <iostream>
 #include <fstream>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include "parallel.h"
 using namespace std;
 
+// **************************************************************
+//    NEIGHBOR ITERATORS
+// **************************************************************
+
+// The edgeMap kernels walk neighbor lists through these iterators rather
+// than by index, so that compressed lists can be decoded as they are read.
+
+struct plainNeighborIter {
+    intE* p;
+    plainNeighborIter(intE* _p) : p(_p) {}
+    inline uintE next() { return *p++; }
+};
+
+//weighted lists interleave (neighbor, weight)
+struct wghNeighborIter {
+    intE* p;
+    wghNeighborIter(intE* _p) : p(_p) {}
+    inline uintE next() { uintE r = *p; p += 2; return r; }
+};
+
+// Compressed lists are sorted and stored as zigzag-encoded differences
+// (the first one from 0) in a byte varint: 7 bits per byte, high bit set
+// on every byte but the last.
+struct compressedNeighborIter {
+    unsigned char* p;
+    uintE prev;
+    compressedNeighborIter(unsigned char* _p) : p(_p), prev(0) {}
+    inline uintE next() {
+	uintE z = 0;
+	int shift = 0;
+	unsigned char b;
+	do {
+	    b = *p++;
+	    z |= (uintE)(b & 127) << shift;
+	    shift += 7;
+	} while (b & 128);
+	prev += (z & 1) ? ~(z >> 1) : (z >> 1);
+	return prev;
+    }
+};
+
+// encodes the d neighbors in ngh (sorted) into out, or only measures the
+// encoding when out is NULL; returns the number of bytes
+inline long encodeNeighbors(intE* ngh, intT d, unsigned char* out) {
+    long bytes = 0;
+    uintE prev = 0;
+    for (intT j = 0; j < d; j++) {
+	intE delta = (intE)((uintE)ngh[j] - prev);
+	uintE z = (delta < 0) ? ((~(uintE)delta << 1) | 1) : ((uintE)delta << 1);
+	prev = ngh[j];
+	do {
+	    unsigned char b = z & 127;
+	    z >>= 7;
+	    if (z) b |= 128;
+	    if (out) out[bytes] = b;
+	    bytes++;
+	} while (z);
+    }
+    return bytes;
+}
+
 // **************************************************************
 //    ADJACENCY ARRAY REPRESENTATION
 // **************************************************************
@@ -29,6 +91,9 @@ struct symmetricVertex {
     void setFakeDegree(intT _d) { fakeDegree = _d; }
     void setFakeInDegree(intT _d) { fakeDegree = _d; }
     void flipEdges() {}
+    typedef plainNeighborIter neighborIter;
+    neighborIter getInIter() { return neighborIter(neighbors); }
+    neighborIter getOutIter() { return neighborIter(neighbors); }
 };
 
 struct asymmetricVertex {
@@ -55,6 +120,65 @@ struct asymmetricVertex {
     void setFakeDegree(intT _d) { fakeOutDegree = _d; }
     void setFakeInDegree(intT _d) { fakeInDegree = _d; }
     void flipEdges() { swap(inNeighbors,outNeighbors); swap(inDegree,outDegree); }
+    typedef plainNeighborIter neighborIter;
+    neighborIter getInIter() { return neighborIter(inNeighbors); }
+    neighborIter getOutIter() { return neighborIter(outNeighbors); }
+};
+
+// Vertices of the compressed per-node graphs built by
+// graphFilter2DirectionCompressed. Neighbors are only reachable through the
+// iterators; getOutNeighbor/getInNeighbor decode from the start of the list
+// and are kept for code outside the edgeMap kernels.
+struct compressedSymmetricVertex {
+    unsigned char* neighbors;
+    intT degree;
+    intT fakeDegree;
+    typedef compressedNeighborIter neighborIter;
+    void del() {}
+    uintE getInNeighbor(intT j) { return getNeighbor(neighbors, j); }
+    uintE getOutNeighbor(intT j) { return getNeighbor(neighbors, j); }
+    neighborIter getInIter() { return neighborIter(neighbors); }
+    neighborIter getOutIter() { return neighborIter(neighbors); }
+    intT getInDegree() { return degree; }
+    intT getOutDegree() { return degree; }
+    intT getFakeInDegree() { return fakeDegree;}
+    intT getFakeDegree() { return fakeDegree; }
+    void setInBytes(unsigned char* _b) { neighbors = _b; }
+    void setOutBytes(unsigned char* _b) { neighbors = _b; }
+    void setInDegree(intT _d) { degree = _d; }
+    void setOutDegree(intT _d) { degree = _d; }
+    void setFakeDegree(intT _d) { fakeDegree = _d; }
+    void setFakeInDegree(intT _d) { fakeDegree = _d; }
+    static uintE getNeighbor(unsigned char* b, intT j) {
+	neighborIter it(b);
+	for (intT k = 0; k < j; k++) it.next();
+	return it.next();
+    }
+};
+
+struct compressedAsymmetricVertex {
+    unsigned char* inNeighbors;
+    unsigned char* outNeighbors;
+    intT outDegree;
+    intT fakeInDegree;
+    intT fakeOutDegree;
+    intT inDegree;
+    typedef compressedNeighborIter neighborIter;
+    void del() {}
+    uintE getInNeighbor(intT j) { return compressedSymmetricVertex::getNeighbor(inNeighbors, j); }
+    uintE getOutNeighbor(intT j) { return compressedSymmetricVertex::getNeighbor(outNeighbors, j); }
+    neighborIter getInIter() { return neighborIter(inNeighbors); }
+    neighborIter getOutIter() { return neighborIter(outNeighbors); }
+    intT getInDegree() { return inDegree; }
+    intT getOutDegree() { return outDegree; }
+    intT getFakeInDegree() { return fakeInDegree;}
+    intT getFakeDegree() { return fakeOutDegree; }
+    void setInBytes(unsigned char* _b) { inNeighbors = _b; }
+    void setOutBytes(unsigned char* _b) { outNeighbors = _b; }
+    void setInDegree(intT _d) { inDegree = _d; }
+    void setOutDegree(intT _d) { outDegree = _d; }
+    void setFakeDegree(intT _d) { fakeOutDegree = _d; }
+    void setFakeInDegree(intT _d) { fakeInDegree = _d; }
 };
 
 template <class vertex>
@@ -65,17 +189,24 @@ struct graph {
     intE* allocatedInplace;
     intE* inEdges;
     intT* flags;
+    //non-zero when the edge arrays are mmapped instead of malloced
+    long allocatedMapSize;
+    long inEdgesMapSize;
     graph(vertex* VV, intT nn, uintT mm) 
-	: V(VV), n(nn), m(mm), allocatedInplace(NULL), flags(NULL) {}
+	: V(VV), n(nn), m(mm), allocatedInplace(NULL), inEdges(NULL), flags(NULL), allocatedMapSize(0), inEdgesMapSize(0) {}
     graph(vertex* VV, intT nn, uintT mm, intE* ai, intE* _inEdges = NULL) 
-	: V(VV), n(nn), m(mm), allocatedInplace(ai), inEdges(_inEdges), flags(NULL) {}
+	: V(VV), n(nn), m(mm), allocatedInplace(ai), inEdges(_inEdges), flags(NULL), allocatedMapSize(0), inEdgesMapSize(0) {}
     void del() {
 	if (flags != NULL) free(flags);
 	if (allocatedInplace == NULL) 
 	    for (intT i=0; i < n; i++) V[i].del();
+	else if (allocatedMapSize > 0) munmap(allocatedInplace, allocatedMapSize);
 	else free(allocatedInplace);
 	free(V);
-	if(inEdges != NULL) free(inEdges);
+	if (inEdges != NULL) {
+	    if (inEdgesMapSize > 0) munmap(inEdges, inEdgesMapSize);
+	    else free(inEdges);
+	}
     }
     void transpose() {
 	if(sizeof(vertex) == sizeof(asymmetricVertex)) {
@@ -110,6 +241,9 @@ struct symmetricWghVertex {
     void setOutDegree(intT _d) { degree = _d; }
     void setFakeDegree(intT _d) { fakeDegree = _d; }
     void setFakeInDegree(intT _d) { fakeDegree = _d; }
+    typedef wghNeighborIter neighborIter;
+    neighborIter getInIter() { return neighborIter(neighbors); }
+    neighborIter getOutIter() { return neighborIter(neighbors); }
 };
 
 struct asymmetricWghVertex {
@@ -139,6 +273,9 @@ struct asymmetricWghVertex {
     void setOutDegree(intT _d) { outDegree = _d; }
     void setFakeDegree(intT _d) { fakeOutDegree = _d; }
     void setFakeInDegree(intT _d) { fakeInDegree = _d; }
+    typedef wghNeighborIter neighborIter;
+    neighborIter getInIter() { return neighborIter(inNeighbors); }
+    neighborIter getOutIter() { return neighborIter(outNeighbors); }
 };
 
 template <class vertex>
@@ -149,16 +286,22 @@ struct wghGraph {
     intE* allocatedInplace;
     intE* inEdges;
     intT* flags;
+    long allocatedMapSize;
+    long inEdgesMapSize;
     wghGraph(vertex* VV, intT nn, uintT mm) 
-	: V(VV), n(nn), m(mm), allocatedInplace(NULL), flags(NULL) {}
+	: V(VV), n(nn), m(mm), allocatedInplace(NULL), inEdges(NULL), flags(NULL), allocatedMapSize(0), inEdgesMapSize(0) {}
     wghGraph(vertex* VV, intT nn, uintT mm, intE* ai, intE* _inEdges=NULL) 
-	: V(VV), n(nn), m(mm), allocatedInplace(ai), inEdges(_inEdges), flags(NULL) {}
+	: V(VV), n(nn), m(mm), allocatedInplace(ai), inEdges(_inEdges), flags(NULL), allocatedMapSize(0), inEdgesMapSize(0) {}
     void del() {
 	if(flags != NULL) free(flags);
 	if (allocatedInplace == NULL) 
 	    for (intT i=0; i < n; i++) V[i].del();
+	else if (allocatedMapSize > 0) munmap(allocatedInplace, allocatedMapSize);
 	else { free(allocatedInplace); }
 	free(V);
-	if(inEdges != NULL) free(inEdges);
+	if (inEdges != NULL) {
+	    if (inEdgesMapSize > 0) munmap(inEdges, inEdgesMapSize);
+	    else free(inEdges);
+	}
     }
 };
@@ -0,0 +1,134 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef HUB_MIRROR_INCLUDED
+#define HUB_MIRROR_INCLUDED
+
+#include <algorithm>
+#include <numa.h>
+#include "parallel.h"
+
+// Hybrid-cut after PowerLyra (Chen et al., EuroSys'15). Polymer places
+// every edge on the node owning its target, so the owner of a hub receives
+// all of its in-edges and its cores contend on the hub's value. Vertices
+// with an in-degree above a threshold are made hubs: an edge into a hub is
+// placed on the node owning its source instead, and each subworker adds it
+// into a private mirror of the hub. Once per iteration, after the dense
+// edgeMap, the subworkers of the owner combine the mirrors of all nodes
+// into the master value and reset them.
+//
+// Mirrors are plain (non-atomic) rows, one per subworker, allocated on
+// the subworker's node. The owner reads the rows of the other nodes, one
+// value per hub and subworker, instead of taking one remote or contended
+// update per edge.
+
+// whether the local graph of [rangeLow, rangeHi) keeps ngh in the
+// neighbor lists of v: hubs stay with the owner of v, other neighbors
+// with their own owner. In-lists use the same rule, which keeps the
+// shared lists of symmetric vertices consistent.
+inline bool keepsNeighbor(intT *hubIndex, intT v, intT ngh, int rangeLow, int rangeHi) {
+    intT owned = (hubIndex != NULL && hubIndex[ngh] >= 0) ? v : ngh;
+    return rangeLow <= owned && owned < rangeHi;
+}
+
+template <class E>
+struct hubMirrors {
+    intT n;
+    intT numHubs;
+    intT *hubIndex; // position of each vertex in hubs, -1 if it is not a hub
+    intT *hubs;     // ids of the hubs, ascending
+    int numOfNodes;
+    int coresPerNode;
+    E identity;     // the value combining with anything leaves unchanged
+    E **rows;       // numHubs mirrors per subworker, node-major
+
+    template <class graphType>
+    hubMirrors(graphType &GA, intT threshold, int _numOfNodes, int _coresPerNode, E _identity) :
+	n(GA.n), numOfNodes(_numOfNodes), coresPerNode(_coresPerNode), identity(_identity) {
+	hubIndex = newA(intT, n);
+	numHubs = 0;
+	long hubEdges = 0;
+	for (intT i = 0; i < n; i++) {
+	    if (GA.V[i].getInDegree() > threshold) {
+		hubIndex[i] = numHubs++;
+		hubEdges += GA.V[i].getInDegree();
+	    } else {
+		hubIndex[i] = -1;
+	    }
+	}
+	hubs = newA(intT, numHubs + 1);
+	for (intT i = 0; i < n; i++) {
+	    if (hubIndex[i] >= 0) hubs[hubIndex[i]] = i;
+	}
+	rows = newA(E*, numOfNodes * coresPerNode);
+	for (int i = 0; i < numOfNodes * coresPerNode; i++) rows[i] = NULL;
+	printf("hubs: %d vertices with in-degree above %d hold %ld of %ld edges\n",
+	       numHubs, threshold, hubEdges, (long)GA.m);
+    }
+
+    // called by the worker of node tid once it is bound to its node
+    void allocRows(int tid) {
+	for (int i = 0; i < coresPerNode; i++) {
+	    E *row = (E *)numa_alloc_local(sizeof(E) * (numHubs + 1));
+	    for (intT k = 0; k < numHubs; k++) row[k] = identity;
+	    rows[tid * coresPerNode + i] = row;
+	}
+    }
+
+    E *getRow(int tid, int subTid) {
+	return rows[tid * coresPerNode + subTid];
+    }
+
+    // Folds the mirrors of the hubs in [rangeLow, rangeHi) into their
+    // masters; the hubs are dealt round-robin to the subworkers of the
+    // owner. f.combine(a, b) merges two mirror values and f.apply(v, val)
+    // merges the result into the master of v; hubs no edge reached this
+    // iteration are left alone, as the edgeMap would. Must run after a global
+    // barrier following the edgeMap, and before one preceding the next.
+    template <class F>
+    void sync(int rangeLow, int rangeHi, int subTid, F f) {
+	intT first = lower_bound(hubs, hubs + numHubs, (intT)rangeLow) - hubs;
+	int numOfRows = numOfNodes * coresPerNode;
+	for (intT k = first + subTid; k < numHubs && hubs[k] < rangeHi; k += coresPerNode) {
+	    E val = identity;
+	    for (int r = 0; r < numOfRows; r++) {
+		val = f.combine(val, rows[r][k]);
+		rows[r][k] = identity;
+	    }
+	    if (val != identity) f.apply(hubs[k], val);
+	}
+    }
+
+    void del() {
+	for (int i = 0; i < numOfNodes * coresPerNode; i++) {
+	    if (rows[i] != NULL) numa_free(rows[i], sizeof(E) * (numHubs + 1));
+	}
+	free(rows);
+	free(hubs);
+	free(hubIndex);
+    }
+};
+
+#endif
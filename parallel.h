@@ -24,6 +24,7 @@
 
 #if defined(CILK)
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 #define parallel_main main
 #define parallel_for cilk_for
 #define parallel_for_1 _Pragma("cilk_grainsize = 1") cilk_for
@@ -32,6 +33,7 @@
 // intel cilk+
 #elif defined(CILKP)
 #include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 #define parallel_for cilk_for
 #define parallel_main main
 #define parallel_for_1 _Pragma("cilk grainsize = 1") cilk_for
@@ -79,3 +81,17 @@ typedef unsigned long uintE;
 typedef int intE;
 typedef unsigned int uintE;
 #endif
+
+#ifndef GET_WORKERS_DEFINED
+#define GET_WORKERS_DEFINED
+// number of workers the parallel_for loops above can run on
+static inline int getWorkers() {
+#if defined(CILK) || defined(CILKP)
+  return __cilkrts_get_nworkers();
+#elif defined(OPENMP)
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+#endif
@@ -0,0 +1,87 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef PARTITION_INCLUDED
+#define PARTITION_INCLUDED
+
+#include <algorithm>
+#include "parallel.h"
+
+// Helpers for partitionByDegree and subPartitionByDegree. The vertices are
+// grouped into blocks (a vertex-data page, or a single vertex) whose degree
+// sums are scanned in parallel; every cut point is then found by a binary
+// search over the prefix sums instead of a serial sweep over all vertices.
+// Sums are 64-bit, so graphs with more than 2^31 edges do not overflow.
+
+// Fills prefix[0..numBlocks] with the sums of degrees before each block of
+// blockSize consecutive vertices; prefix must hold numBlocks + 1 entries.
+inline void blockPrefix(long *degrees, intT n, long blockSize, long *prefix) {
+    long numBlocks = (n + blockSize - 1) / blockSize;
+    {parallel_for (long b = 0; b < numBlocks; b++) {
+	    long sum = 0;
+	    long e = min((long)n, (b + 1) * blockSize);
+	    for (long i = b * blockSize; i < e; i++) sum += degrees[i];
+	    prefix[b] = sum;
+	}}
+    prefix[numBlocks] = sequence::plusScan(prefix, prefix, numBlocks);
+}
+
+// Cuts the blocks into numOfShards ranges, cuts[k] to cuts[k + 1], the
+// way the serial sweep did: a shard is closed by the first block that
+// brings it to the average degree, the last shard takes what is left.
+// With nearest, that block moves to the next shard when the shard ends
+// closer to the average without it; the next shard is then not closed
+// before it has taken one more block.
+inline void cutPrefix(long *prefix, long numBlocks, int numOfShards, long *cuts, bool nearest) {
+    long average = prefix[numBlocks] / numOfShards;
+    bool carried = false;
+    cuts[0] = 0;
+    for (int k = 0; k < numOfShards - 1; k++) {
+	long start = cuts[k];
+	long first = start + (carried ? 2 : 1);
+	carried = false;
+	long *e = (first > numBlocks) ? prefix + numBlocks + 1 :
+	    std::lower_bound(prefix + first, prefix + numBlocks + 1, prefix[start] + average);
+	if (e == prefix + numBlocks + 1) {
+	    cuts[k + 1] = numBlocks;
+	    continue;
+	}
+	long end = e - prefix;
+	if (nearest && average - (prefix[end - 1] - prefix[start]) < prefix[end] - prefix[start] - average) {
+	    end--;
+	    carried = true;
+	}
+	cuts[k + 1] = end;
+    }
+    cuts[numOfShards] = numBlocks;
+}
+
+// Converts block cuts into the number of vertices of each shard.
+inline void cutsToSizes(long *cuts, int numOfShards, intT n, long blockSize, int *sizeArr) {
+    for (int k = 0; k < numOfShards; k++)
+	sizeArr[k] = min((long)n, cuts[k + 1] * blockSize) - min((long)n, cuts[k] * blockSize);
+}
+
+#endif
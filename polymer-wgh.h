@@ -37,6 +37,13 @@
 #include "utils.h"
 #include "graph.h"
 #include "IO.h"
+#include "hub-mirror.h"
+#include "rebalance.h"
+#include "direction.h"
+#include "partition.h"
+#include "sparse-chunk.h"
+#include "frontier-arena.h"
+#include "bitmap.h"
 
 #include <numa.h>
 #include <pthread.h>
@@ -83,7 +90,10 @@ struct Subworker_Partitioner {
     Custom_barrier local_custom;
     Custom_barrier subMaster_custom;
     
-    Subworker_Partitioner(int nSub):numOfSub(nSub){}
+    Dense_Balancer *balancer; // moves the dense ranges when set
+    Direction_Optimizer *direction; // picks the node's mode when set
+
+    Subworker_Partitioner(int nSub):numOfSub(nSub), balancer(NULL), direction(NULL){}
     
     inline bool isMaster() {return (tid + subTid == 0);}
     inline bool isSubMaster() {return (subTid == 0);}
@@ -100,6 +110,37 @@ struct Subworker_Partitioner {
 	}
 	local_custom.wait();
     }
+    // after a dense round: stores the work of this subworker's range, and
+    // of the blocks it ran for other nodes, and takes its new range once
+    // the submaster, and the master for the nodes, have rebalanced
+    inline void balanceDense(long work, long borrowed = 0) {
+	if (balancer == NULL)
+	    return;
+	balancer->work[subTid] = work;
+	balancer->borrowed[subTid] = borrowed;
+	localWait();
+	if (isSubMaster())
+	    balancer->rebalance();
+	Node_Balancer *nodes = balancer->nodes;
+	if (nodes != NULL) {
+	    // also waits for the blocks written into other nodes' frontiers
+	    globalWait();
+	    if (isMaster())
+		nodes->rebalance();
+	    globalWait();
+	    if (isSubMaster())
+		balancer->retarget(nodes->ownStart(tid), nodes->ownEnd(tid));
+	}
+	localWait();
+	dense_start = balancer->cuts[subTid];
+	dense_end = balancer->cuts[subTid + 1];
+    }
+
+    // the part of a block of borrowed rows [lo, hi) this subworker runs
+    inline void borrowedPart(intT lo, intT hi, intT &start, intT &end) {
+	start = lo + getStartPos(hi - lo);
+	end = lo + getEndPos(hi - lo);
+    }
 };
 
 struct Default_Hash_F {
@@ -130,9 +171,7 @@ struct Default_Hash_F {
 template <class vertex>
 void partitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false) {
     const intT n = GA.n;
-    int *degrees = newA(int, n);
-
-    int shardSize = n / numOfShards;
+    long *degrees = newA(long, n);
 
     if (useOutDegree) {
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getOutDegree();}
@@ -140,48 +179,28 @@ void partitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, int s
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getInDegree();}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
-
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
+    // shards are cut at vertex-data page boundaries
+    long vertPerPage = PAGESIZE / sizeOfOneEle;
+    long numBlocks = (n + vertPerPage - 1) / vertPerPage;
+    long *prefix = newA(long, numBlocks + 1);
+    blockPrefix(degrees, n, vertPerPage, prefix);
 
-    int averageDegree = totalDegree / numOfShards;
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i+=PAGESIZE/sizeOfOneEle) {
-	for (intT j = 0; j < PAGESIZE / sizeOfOneEle; j++) {
-	    if (i + j >= n)
-		break;
-	    accum[counter] += degrees[i + j];
-	    sizeArr[counter]++;
-	    tmpSizeCounter++;
-	}
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    counter++;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, numBlocks, numOfShards, cuts, false);
+    cutsToSizes(cuts, numOfShards, n, vertPerPage, sizeArr);
 
     for (int i = 0; i < numOfShards; i++) {
-	printf("%d shard: %d\n", i, accum[i]);
+	printf("%d shard: %ld\n", i, prefix[cuts[i + 1]] - prefix[cuts[i]]);
     }
-    
+
+    free(prefix);
     free(degrees);
 }
 
 template <class vertex>
 void subPartitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false, bool useFakeDegree=false) {
     const intT n = GA.n;
-    int *degrees = newA(int, n);
-
-    int shardSize = n / numOfShards;
+    long *degrees = newA(long, n);
 
     if (useFakeDegree) {
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getFakeDegree();}
@@ -193,41 +212,20 @@ void subPartitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, in
 	}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
-
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
-    
-
-    int averageDegree = totalDegree / numOfShards;
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i++) {
-	accum[counter] += degrees[i];
-	sizeArr[counter]++;
-	tmpSizeCounter++;
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    counter++;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
+    long *prefix = newA(long, n + 1);
+    blockPrefix(degrees, n, 1, prefix);
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, n, numOfShards, cuts, false);
+    cutsToSizes(cuts, numOfShards, n, 1, sizeArr);
 
+    free(prefix);
     free(degrees);
 }
 
 template <class vertex>
 void subPartitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, int subStart, int subEnd, bool useOutDegree=false, bool useFakeDegree=false) {
     const intT n = subEnd - subStart;
-    int *degrees = newA(int, n);
-
-    int shardSize = n / numOfShards;
+    long *degrees = newA(long, n);
 
     if (useFakeDegree) {
 	{parallel_for(intT i = subStart; i < subEnd; i++) degrees[i-subStart] = GA.V[i].getFakeDegree();}
@@ -239,31 +237,13 @@ void subPartitionByDegree(wghGraph<vertex> GA, int numOfShards, int *sizeArr, in
 	}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
-
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
+    long *prefix = newA(long, n + 1);
+    blockPrefix(degrees, n, 1, prefix);
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, n, numOfShards, cuts, false);
+    cutsToSizes(cuts, numOfShards, n, 1, sizeArr);
 
-    int averageDegree = totalDegree / numOfShards;
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i++) {
-	accum[counter] += degrees[i];
-	sizeArr[counter]++;
-	tmpSizeCounter++;
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    counter++;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
-    
+    free(prefix);
     free(degrees);
 }
 
@@ -393,7 +373,7 @@ wghGraph<vertex> graphFilter(wghGraph<vertex> &GA, int rangeLow, int rangeHi, bo
 }
 
 template <class vertex>
-wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int rangeHi, bool useOutEdge=true) {
+wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int rangeHi, bool useOutEdge=true, intT *hubIndex = NULL) {
     vertex *V = GA.V;
     vertex *newVertexSet = (vertex *)numa_alloc_local(sizeof(vertex) * GA.n);
     int *counters = (int *)numa_alloc_local(sizeof(int) * GA.n);
@@ -409,7 +389,7 @@ wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int r
 	    counters[i] = 0;
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getOutNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi)
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi))
 		    counters[i]++;
 	    }
 
@@ -417,7 +397,7 @@ wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int r
 	    inCounters[i] = 0;
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getInNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi)
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi))
 		    inCounters[i]++;
 	    }
 	    newVertexSet[i].setFakeDegree(counters[i]);
@@ -449,7 +429,7 @@ wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int r
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getOutNeighbor(j);
 		intT wgh = V[i].getOutWeight(j);
-		if (rangeLow <= ngh && ngh < rangeHi) {
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) {
 		    localEdges[counter * 2] = ngh;
 		    localEdges[counter * 2 + 1] = wgh;
 		    counter++;
@@ -465,7 +445,7 @@ wghGraph<vertex> graphFilter2Direction(wghGraph<vertex> &GA, int rangeLow, int r
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getInNeighbor(j);
 		intT wgh = V[i].getInWeight(j);
-		if (rangeLow <= ngh && ngh < rangeHi) {
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) {
 		    localInEdges[counter * 2] = ngh;
 		    localInEdges[counter * 2 + 1] = wgh;
 		    counter++;
@@ -528,13 +508,25 @@ struct LocalFrontier {
     int endID;
     bool *b;
     intT *s;
+    intT sCap;
+    bool sInArena;       // s was drawn from arena rather than malloc
+    // scratch memory dropped by clearFrontier (see frontier-arena.h): arena
+    // for the submaster, subArenas for each subworker once a kernel needs them
+    frontierArena arena;
+    frontierArena *subArenas;
+    int numOfArenas;
+    // per-subworker output of edgeMapSparseV3 (see sparse-chunk.h)
+    sparseChunk *chunks;
+    // remDups: the round in which each vertex of the range was last added
+    unsigned *claims;
+    unsigned claimRound;
     intT sparseCounter;
     intT **sparseChunks;
     intT *chunkSizes;
     intT *tmp;
     bool isDense;
     
-    LocalFrontier(bool *_b, int start, int end):b(_b), startID(start), endID(end), n(end - start), m(0), isDense(true), s(NULL), outEdgesCount(0), sparseChunks(NULL), chunkSizes(NULL){}
+    LocalFrontier(bool *_b, int start, int end):n(end - start), m(0), outEdgesCount(0), startID(start), endID(end), b(_b), s(NULL), sCap(0), sInArena(false), arena(arenaLocalNode()), subArenas(NULL), numOfArenas(0), chunks(NULL), claims(NULL), claimRound(0), sparseChunks(NULL), chunkSizes(NULL), isDense(true){}
     
     bool inRange(int index) { return (startID <= index && index < endID);}
     inline void setBit(int index, bool val) { b[index-startID] = val;}
@@ -542,12 +534,12 @@ struct LocalFrontier {
 
     void toSparse() {
 	if (isDense) {
-	    if (s != NULL)
-		free(s);
-	    _seq<intT> R = sequence::packIndex(b, n);
+	    releaseSparse();
+	    _seq<intT> R = flagsPack(b, n, startID, arenaIntAlloc(&arena));
 	    s = R.A;
 	    m = R.n;
-	    {parallel_for (intT i = 0; i < m; i++) s[i] = s[i] + startID;}
+	    sCap = m;
+	    sInArena = true;
 	    if (m == 0) {
 		printf("%p\n", s);
 	    } else {
@@ -567,27 +559,100 @@ struct LocalFrontier {
     }
 
     void setSparse(intT _m, intT *_s) {
-	if (s != NULL) {
-	    free(s);
-	}
+	releaseSparse();
 	m = _m;
 	s = _s;
+	sCap = _m;
 	isDense = false;
     }
 
+    void releaseSparse() {
+	if (s != NULL && !sInArena)
+	    free(s);
+	s = NULL;
+	sCap = 0;
+	sInArena = false;
+    }
+
+    // grows s, keeping its first m entries, to hold len; called by the
+    // submaster, the new list comes from arena
+    void reserveSparse(intT len) {
+	if (s != NULL && len <= sCap) return;
+	intT cap = (len < 2 * sCap) ? 2 * sCap : len;
+	intT *A = (intT *)arena.alloc(sizeof(intT) * (cap + 1));
+	if (s != NULL && m > 0)
+	    memcpy(A, s, sizeof(intT) * min(m, sCap));
+	releaseSparse();
+	s = A;
+	sCap = cap;
+	sInArena = true;
+    }
+
+    // creates a subworker arena for each of the node's subworkers; called
+    // by the submaster before the local barrier preceding their use
+    void prepareArenas(int numOfSub) {
+	if (subArenas == NULL)
+	    subArenas = newFrontierArenas(numOfSub, arena.node);
+	numOfArenas = numOfSub;
+    }
+
+    // Starts a round of claim(); called by the submaster before the local
+    // barrier preceding the edgeMap. Stamps are never cleared, a new
+    // round number invalidates them all.
+    void beginClaims() {
+	if (claims == NULL)
+	    claims = (unsigned *)numa_alloc_local(sizeof(unsigned) * (n + 1));
+	if (++claimRound == 0) {
+	    memset(claims, 0, sizeof(unsigned) * (n + 1));
+	    claimRound = 1;
+	}
+    }
+
+    // whether this is the first time v, which must be in the range, is
+    // added this round: the first subworker to stamp it wins
+    inline bool claim(intT v) {
+	unsigned *p = &claims[v - startID];
+	unsigned old = *p;
+	return old != claimRound && __sync_bool_compare_and_swap(p, old, claimRound);
+    }
+
+    // Called by every subworker of the node once its chunk is complete:
+    // concatenates the chunks into s, in subworker order, and sets m.
+    void gatherChunks(Subworker_Partitioner &subworker) {
+	subworker.localWait();
+	if (subworker.isSubMaster()) {
+	    intT total = sparseChunkOffset(chunks, subworker.numOfSub);
+	    reserveSparse(total);
+	    m = total;
+	}
+	subworker.localWait();
+	sparseChunk &out = chunks[subworker.subTid];
+	if (out.n > 0)
+	    memcpy(s + sparseChunkOffset(chunks, subworker.subTid), out.A, sizeof(intT) * out.n);
+    }
+
     bool *swapBitVector(bool *newB) {
 	bool *tmp = b;
 	b = newB;
 	return tmp;
     }
 
+    // the frontier is about to become the next output: its list and
+    // scratch buffers are dropped
     void clearFrontier() {
-	if (s != NULL) {
-	    free(s);
-	}
-	s = NULL;
 	m = 0;
 	outEdgesCount = 0;
+	if (sInArena) {
+	    s = NULL;
+	    sCap = 0;
+	    sInArena = false;
+	}
+	arena.reset();
+	for (int i = 0; subArenas != NULL && i < numOfArenas; i++) {
+	    subArenas[i].reset();
+	    if (chunks != NULL)
+		chunks[i].release();
+	}
     }
 };
 
@@ -598,6 +663,8 @@ struct vertices {
     intT numOfVertices;
     int *numOfVertexOnNode;
     int *offsets;
+    int ownerShift;
+    int *owner; // node of the first vertex of every 2^ownerShift vertices
     int *numOfNonZero;
     bool** d;
     LocalFrontier **frontiers;
@@ -617,6 +684,7 @@ struct vertices {
 	offsets = (int *)malloc((numOfNodes + 1) * sizeof(int));
 	numOfNonZero = (int *)malloc(numOfNodes * sizeof(int));
 	numOfVertices = 0;
+	owner = NULL;
 	m = -1;
     }
     /*
@@ -655,6 +723,27 @@ struct vertices {
 	}
     }
 
+    // Readies the frontiers for a round in which node i runs dense when
+    // modes[i] is set: bits for dense nodes, lists for sparse ones. When
+    // the nodes disagree every frontier keeps both, as converting one
+    // leaves the other valid. Works frontier by frontier, since the
+    // last round may have left them in different modes.
+    void prepareModes(char *modes) {
+	bool anyDense = false, anySparse = false;
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (modes[i]) anyDense = true;
+	    else anySparse = true;
+	}
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (frontiers[i]->isDense) {
+		if (anySparse) frontiers[i]->toSparse();
+	    } else if (anyDense) {
+		frontiers[i]->toDense();
+	    }
+	}
+	isDense = !anySparse;
+    }
+
     intT getEdgeStat() {
 	intT sum = 0;
 	for (int i = 0; i < numOfNodes; i++) {
@@ -673,6 +762,34 @@ struct vertices {
 	    //printf("offset of %d: %d\n", i, offsets[i]);
 	}
 	offsets[numOfNodes] = numOfVertices;
+
+	// slots are no wider than the smallest non-empty range, so nodeOf
+	// moves past at most one boundary, plus those of empty nodes
+	int minSize = numOfVertices;
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (numOfVertexOnNode[i] > 0 && numOfVertexOnNode[i] < minSize)
+		minSize = numOfVertexOnNode[i];
+	}
+	ownerShift = 0;
+	while ((2 << ownerShift) <= minSize) ownerShift++;
+	intT slots = (numOfVertices >> ownerShift) + 1;
+	owner = newA(int, slots);
+	int k = 0;
+	for (intT j = 0; j < slots; j++) {
+	    while (k < numOfNodes - 1 && (j << ownerShift) >= offsets[k + 1]) k++;
+	    owner[j] = k;
+	}
+    }
+
+    // node owning a vertex, in constant time
+    inline int nodeOf(intT index) {
+	int k = owner[index >> ownerShift];
+	while (k < numOfNodes - 1 && index >= offsets[k + 1]) k++;
+	return k;
+    }
+
+    inline LocalFrontier *frontierOf(intT index) {
+	return frontiers[nodeOf(index)];
     }
 
     int getSize(int nodeNum) {
@@ -718,11 +835,7 @@ struct vertices {
     }
 
     int getNodeNumOfIndex(int index) {
-	int result = 0;
-	while (result < numOfNodes && offsets[result] <= index) {
-	    result++;
-	}
-	return result - 1;
+	return nodeOf(index);
     }
 
     int getNodeNumOfSparseIndex(int index) {
@@ -739,24 +852,13 @@ struct vertices {
 	return offsets[nodeNum];
     }
 
-    void setBit(int index, bool bit) {
-	int accum = 0;
-	int i = 0;
-        while (index >= accum + numOfVertexOnNode[i]) {
-	    accum += numOfVertexOnNode[i];
-	    i++;
-	}
-	*(frontiers[i]->b + (index - accum)) = bit;
+    // the frontiers of all nodes read and written as one
+    inline void setBit(intT index, bool bit) {
+	frontierOf(index)->setBit(index, bit);
     }
 
-    bool getBit(int index) {
-	int accum = 0;
-	int i = 0;
-        while (index >= accum + numOfVertexOnNode[i]) {
-	    accum += numOfVertexOnNode[i];
-	    i++;
-	}
-	return *(frontiers[i]->b + (index - accum));
+    inline bool getBit(intT index) {
+	return frontierOf(index)->getBit(index);
     }
 
     bool *getArr(int nodeNum) {
@@ -795,6 +897,7 @@ struct vertices {
 
     void del() {
 	free(offsets);
+	if (owner != NULL) free(owner);
 	free(numOfVertexOnNode);
 	free(d);
     }
@@ -886,7 +989,7 @@ bool* edgeMapDense(wghGraph<vertex> GA, vertices* frontier, F f, LocalFrontier *
 }
 
 template <class F, class vertex>
-bool* edgeMapDenseForward(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, int start = 0, int end = 0) {
+bool* edgeMapDenseForward(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, int start = 0, int end = 0, long *work = NULL) {
     intT numVertices = GA.n;
     vertex *G = GA.V;
 
@@ -899,6 +1002,7 @@ bool* edgeMapDenseForward(wghGraph<vertex> GA, vertices *frontier, F f, LocalFro
     intT m = 0;
     intT outEdgesCount = 0;
     bool *nextB = next->b;
+    long traversed = 0;
     
     int startPos = 0;
     int endPos = numVertices;
@@ -923,6 +1027,7 @@ bool* edgeMapDenseForward(wghGraph<vertex> GA, vertices *frontier, F f, LocalFro
 	m += G[i].getFakeDegree();
 	if (currBitVector[i-currOffset]) {
 	    intT d = G[i].getFakeDegree();
+	    traversed += d;
 	    for(intT j=0; j<d; j++){
 		uintT ngh = G[i].getOutNeighbor(j);
 		if (/*next->inRange(ngh) &&*/ f.cond(ngh) && f.updateAtomic(i, ngh, G[i].getOutWeight(j))) {
@@ -945,6 +1050,8 @@ bool* edgeMapDenseForward(wghGraph<vertex> GA, vertices *frontier, F f, LocalFro
     //writeAdd(&(next->m), m);
     //writeAdd(&(next->outEdgesCount), outEdgesCount);
     //printf("edgeMap: %d %d\n", m, outEdgesCount);
+    if (work != NULL)
+	*work = (endPos - startPos) + traversed;
     return NULL;
 }
 
@@ -1272,24 +1379,27 @@ void edgeMapSparseAsync(wghGraph<vertex> GA, vertices *frontier, F f, LocalFront
 }
 
 template <class F, class vertex>
-void edgeMapSparseV3(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner) {
+void edgeMapSparseV3(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner, bool remDups = false) {
     vertex *V = GA.V;
     if (part) {
 	intT currM = frontier->numNonzeros();
 	int startPos = subworker.getStartPos(currM);
 	int endPos = subworker.getEndPos(currM);
 
-	intT *mPtr = &(next->m);
-	*mPtr = 0;
 	next->outEdgesCount = 0;
-	int bufferLen = frontier->getEdgeStat();
-	if (subworker.isSubMaster())
-	    next->s = (intT *)malloc(sizeof(intT) * bufferLen);
+	if (subworker.isSubMaster()) {
+	    next->prepareArenas(subworker.numOfSub);
+	    if (next->chunks == NULL)
+		next->chunks = newSparseChunks(subworker.numOfSub, next->subArenas);
+	}
+	if (remDups && subworker.isSubMaster())
+	    next->beginClaims();
 	intT nextEdgesCount = 0;
 	
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
-	intT *nextFrontier = next->s;
+	sparseChunk &out = next->chunks[subworker.subTid];
+	out.n = 0;
 	
 	if (startPos < endPos) {
 	    //printf("have ele: %d to %d %d, %p\n", startPos, endPos, subworker.tid, next);	    
@@ -1319,11 +1429,8 @@ void edgeMapSparseV3(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier
 		for (intT j = 0; j < d; j++) {
 		    uintT ngh = V[idx].getOutNeighbor(j);
 		    //printf("from %d to %d len %d\n", idx, ngh, V[idx].getOutWeight(j));
-		    if (f.cond(ngh) && f.updateAtomic(idx, ngh, V[idx].getOutWeight(j))) {
-			int tmp = __sync_fetch_and_add(mPtr, 1);
-			if (tmp >= bufferLen)
-			    printf("oops\n");
-			nextFrontier[tmp] = ngh;
+		    if (f.cond(ngh) && f.updateAtomic(idx, ngh, V[idx].getOutWeight(j)) && (!remDups || next->claim(ngh))) {
+			out.push(ngh);
 			nextEdgesCount += V[ngh].getOutDegree();
 		    }
 		}
@@ -1331,6 +1438,7 @@ void edgeMapSparseV3(wghGraph<vertex> GA, vertices *frontier, F f, LocalFrontier
 		//printf("nextM: %d %d\n", nextM, nextEdgesCount);
 	    }
 	}
+	next->gatherChunks(subworker);
 	__sync_fetch_and_add(&(next->outEdgesCount), nextEdgesCount);
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
@@ -1355,6 +1463,54 @@ void switchFrontier(int nodeNum, vertices *V, LocalFrontier* &next) {
 
 void clearLocalFrontier(LocalFrontier *next, int nodeNum, int subNum, int totalSub);
 
+// With a Direction_Optimizer (see direction.h) the submasters pick
+// their nodes' modes and the master readies the frontiers for them.
+// Returns whether this node runs dense.
+inline bool chooseDirection(vertices *V, Subworker_Partitioner &subworker) {
+    Direction_Optimizer *dir = subworker.direction;
+    if (subworker.isSubMaster())
+	dir->decide(V->numNonzeros(), V->getEdgeStat(), V->numOfVertices);
+    subworker.globalWait();
+    if (subworker.isMaster())
+	V->prepareModes(dir->modes);
+    if (subworker.isSubMaster())
+	dir->startRound();
+    return dir->modes[subworker.tid];
+}
+
+// times the node's round once all its subworkers are done
+inline void finishDirection(Subworker_Partitioner &subworker) {
+    if (subworker.direction == NULL)
+	return;
+    subworker.localWait();
+    if (subworker.isSubMaster())
+	subworker.direction->endRound();
+}
+
+// Runs this subworker's part of the blocks its node borrowed from its
+// neighbours (see Node_Balancer in rebalance.h) on the lenders' local
+// graphs, writing into their next frontiers. Returns the work done.
+template <class F, class graphType>
+long edgeMapDenseBorrowed(graphType &, vertices *V, F f, Subworker_Partitioner &subworker) {
+    Node_Balancer *nodes = (subworker.balancer != NULL) ? subworker.balancer->nodes : NULL;
+    if (nodes == NULL)
+	return 0;
+    long total = 0;
+    for (int side = 0; side < 2; side++) {
+	int lender;
+	intT lo, hi, start, end;
+	if (!nodes->borrowedBlock(subworker.tid, side, lender, lo, hi))
+	    continue;
+	subworker.borrowedPart(lo, hi, start, end);
+	if (start >= end)
+	    continue;
+	long work = 0;
+	edgeMapDenseForward(*(graphType *)nodes->graphs[lender], V, f, V->nextFrontiers[lender], true, start, end, &work);
+	total += work;
+    }
+    return total;
+}
+
 // decides on sparse or dense base on number of nonzeros in the active vertices
 template <class F, class vertex>
 void edgeMap(wghGraph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT threshold = -1, 
@@ -1371,39 +1527,46 @@ void edgeMap(wghGraph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT th
     int start = subworker.dense_start;
     int end = subworker.dense_end;
 
+    bool dense = (subworker.direction != NULL) ? chooseDirection(V, subworker) : (m >= threshold);
     if (subworker.isMaster()) {
-	printf(((m >= threshold) ? "Dense\n" : "Sparse\n"));
+	printf((dense ? "Dense\n" : "Sparse\n"));
     }
 
-    if (m >= threshold) {
+    if (dense) {
 	//Dense part
-	if (subworker.isMaster()) {
+	if (subworker.isMaster() && subworker.direction == NULL) {
 	    V->toDense();	    
 	}
 
 	if (subworker.isSubMaster()) {
 	    next->sparseCounter = 0;
+	    V->nextFrontiers[subworker.tid] = next;
 	}
 	clearLocalFrontier(next, subworker.tid, subworker.subTid, subworker.numOfSub);
 	//pthread_barrier_wait(subworker.global_barr);
 	subworker.globalWait();
 	
+	long work = 0;
 	bool* R = (option == DENSE_FORWARD) ? 
-	    edgeMapDenseForward(GA, V, f, next, part, start, end) :
+	    edgeMapDenseForward(GA, V, f, next, part, start, end, &work) :
 	    //edgeMapDenseForwardDynamic(GA, V, f, next, subworker) :
 	    edgeMapDense(GA, V, f, next, option, subworker);
+	long borrowed = (option == DENSE_FORWARD) ? edgeMapDenseBorrowed(GA, V, f, subworker) : 0;
 	next->isDense = true;
+	if (option == DENSE_FORWARD)
+	    subworker.balanceDense(work, borrowed);
     } else {
 	//Sparse part
-	if (subworker.isMaster()) {
+	if (subworker.isMaster() && subworker.direction == NULL) {
 	    V->toSparse();
 	}
 
 	//pthread_barrier_wait(subworker.global_barr);
 	subworker.globalWait();
-	edgeMapSparseV3(GA, V, f, next, part, subworker);
+	edgeMapSparseV3(GA, V, f, next, part, subworker, remDups);
 	next->isDense = false;
     }
+    finishDirection(subworker);
 }
 
 //*****VERTEX FUNCTIONS*****
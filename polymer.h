@@ -29,6 +29,7 @@
 #include <cstring>
 #include <string>
 #include <algorithm>
+#include <cmath>
 #include <sys/mman.h>
 
 #include "custom-barrier.h"
@@ -37,6 +38,14 @@
 #include "utils.h"
 #include "graph.h"
 #include "IO-numa.h"
+#include "reorder.h"
+#include "hub-mirror.h"
+#include "rebalance.h"
+#include "direction.h"
+#include "partition.h"
+#include "sparse-chunk.h"
+#include "frontier-arena.h"
+#include "bitmap.h"
 
 #include <numa.h>
 #include <pthread.h>
@@ -84,7 +93,10 @@ struct Subworker_Partitioner {
     Custom_barrier local_custom;
     Custom_barrier subMaster_custom;
 
-    Subworker_Partitioner(int nSub):numOfSub(nSub){}
+    Dense_Balancer *balancer; // moves the dense ranges when set
+    Direction_Optimizer *direction; // picks the node's mode when set
+
+    Subworker_Partitioner(int nSub):numOfSub(nSub), balancer(NULL), direction(NULL){}
     
     inline bool isMaster() {return (tid + subTid == 0);}
     inline bool isSubMaster() {return (subTid == 0);}
@@ -101,6 +113,37 @@ struct Subworker_Partitioner {
 	}
 	local_custom.wait();
     }
+    // after a dense round: stores the work of this subworker's range, and
+    // of the blocks it ran for other nodes, and takes its new range once
+    // the submaster, and the master for the nodes, have rebalanced
+    inline void balanceDense(long work, long borrowed = 0) {
+	if (balancer == NULL)
+	    return;
+	balancer->work[subTid] = work;
+	balancer->borrowed[subTid] = borrowed;
+	localWait();
+	if (isSubMaster())
+	    balancer->rebalance();
+	Node_Balancer *nodes = balancer->nodes;
+	if (nodes != NULL) {
+	    // also waits for the blocks written into other nodes' frontiers
+	    globalWait();
+	    if (isMaster())
+		nodes->rebalance();
+	    globalWait();
+	    if (isSubMaster())
+		balancer->retarget(nodes->ownStart(tid), nodes->ownEnd(tid));
+	}
+	localWait();
+	dense_start = balancer->cuts[subTid];
+	dense_end = balancer->cuts[subTid + 1];
+    }
+
+    // the part of a block of borrowed rows [lo, hi) this subworker runs
+    inline void borrowedPart(intT lo, intT hi, intT &start, intT &end) {
+	start = lo + getStartPos(hi - lo);
+	end = lo + getEndPos(hi - lo);
+    }
 };
 
 struct Default_Hash_F {
@@ -131,9 +174,7 @@ struct Default_Hash_F {
 template <class vertex>
 void partitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false) {
     const intT n = GA.n;
-    int *degrees = newA(int, n);
-
-    int shardSize = n / numOfShards;
+    long *degrees = newA(long, n);
 
     if (useOutDegree) {
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getOutDegree();}
@@ -141,62 +182,129 @@ void partitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int size
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getInDegree();}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
+    // shards are cut at vertex-data page boundaries
+    long vertPerPage = PAGESIZE / sizeOfOneEle;
+    long numBlocks = (n + vertPerPage - 1) / vertPerPage;
+    long *prefix = newA(long, numBlocks + 1);
+    blockPrefix(degrees, n, vertPerPage, prefix);
 
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
+    long average = prefix[numBlocks] / numOfShards;
+    printf("average is %ld\n", average);
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, numBlocks, numOfShards, cuts, true);
+    cutsToSizes(cuts, numOfShards, n, vertPerPage, sizeArr);
 
-    int averageDegree = totalDegree / numOfShards;
-    printf("average is %d\n", averageDegree);
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i+=PAGESIZE/sizeOfOneEle) {
-	int localAccum = 0;
-	int localSize = 0;
-	for (intT j = 0; j < PAGESIZE / sizeOfOneEle; j++) {
-	    if (i + j >= n)
-		break;
-	    //accum[counter] += degrees[i + j];
-	    //sizeArr[counter]++;
-	    localAccum += degrees[i + j];
-	    localSize++;
-	    tmpSizeCounter++;
-	}
-	accum[counter] += localAccum;
-	sizeArr[counter] += localSize;
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    int oldDiff = averageDegree - (accum[counter] - localAccum);
-	    int newDiff = accum[counter] - averageDegree;
-	    if (oldDiff < newDiff) {
-		accum[counter] -= localAccum;
-		sizeArr[counter] -= localSize;
-	    } else {
-		localAccum = 0;
-		localSize = 0;
-	    }
-	    counter++;
-	    accum[counter] += localAccum;
-	    sizeArr[counter] += localSize;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
-    
+    free(prefix);
     free(degrees);
 }
 
+// Prints, for each shard, its vertices, vertex-data pages and in- and
+// out-edges, followed by the imbalance (largest share over the average)
+// of every one of these.
 template <class vertex>
-void subPartitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false, bool useFakeDegree=false) {
+void reportPartition(graph<vertex> &GA, int numOfShards, int *sizeArr, int sizeOfOneEle) {
+    long load[numOfShards][4];
+    long total[4] = {0, 0, 0, 0};
+    intT start = 0;
+    for (int i = 0; i < numOfShards; i++) {
+	load[i][0] = sizeArr[i];
+	load[i][1] = ((long)sizeArr[i] * sizeOfOneEle + PAGESIZE - 1) / PAGESIZE;
+	load[i][2] = load[i][3] = 0;
+	for (intT j = start; j < start + sizeArr[i]; j++) {
+	    load[i][2] += GA.V[j].getInDegree();
+	    load[i][3] += GA.V[j].getOutDegree();
+	}
+	start += sizeArr[i];
+	printf("shard %d: %ld vertices, %ld pages, %ld in-edges, %ld out-edges\n", i, load[i][0], load[i][1], load[i][2], load[i][3]);
+	for (int c = 0; c < 4; c++) total[c] += load[i][c];
+    }
+    const char *names[4] = {"vertices", "pages", "in-edges", "out-edges"};
+    printf("imbalance:");
+    for (int c = 0; c < 4; c++) {
+	long most = 0;
+	for (int i = 0; i < numOfShards; i++) most = max(most, load[i][c]);
+	printf(" %s %.3f", names[c], total[c] > 0 ? most * numOfShards / (double)total[c] : 1.0);
+    }
+    printf("\n");
+}
+
+// Furthest page a shard starting at page start can extend to while none of
+// its weighted loads exceeds bound times the average share of that load.
+inline long furthestCut(long *prefix, long numPages, long start, double *scale, double bound) {
+    long end = numPages;
+    for (int c = 0; c < 3; c++) {
+	if (scale[c] == 0) continue;
+	long lo = start, hi = end;
+	while (lo < hi) {
+	    long mid = (lo + hi + 1) / 2;
+	    if ((prefix[3 * mid + c] - prefix[3 * start + c]) * scale[c] <= bound) lo = mid;
+	    else hi = mid - 1;
+	}
+	end = lo;
+    }
+    return end;
+}
+
+// Cuts the vertices into numOfShards ranges of whole vertex-data pages,
+// like partitionByDegree, but balances several loads at once: vertices
+// (and with them the data pages each node maps), in-edges and out-edges.
+// A shard's imbalance is the largest of its loads over the average, each
+// multiplied by its weight. The smallest bound on it that still lets
+// numOfShards greedy shards cover every page is found by bisection, so the
+// worst shard is as balanced as contiguous page ranges allow.
+template <class vertex>
+void partitionByConstraints(graph<vertex> &GA, int numOfShards, int *sizeArr, int sizeOfOneEle, double vertWeight = 1.0, double inWeight = 1.0, double outWeight = 1.0) {
     const intT n = GA.n;
-    int *degrees = newA(int, n);
+    const long vertPerPage = PAGESIZE / sizeOfOneEle;
+    const long numPages = (n + vertPerPage - 1) / vertPerPage;
+    const double weights[3] = {vertWeight, inWeight, outWeight};
+
+    // prefix sums over the pages of the three loads
+    long *prefix = newA(long, 3 * (numPages + 1));
+    prefix[0] = prefix[1] = prefix[2] = 0;
+    {parallel_for (long p = 0; p < numPages; p++) {
+	    long *l = prefix + 3 * (p + 1);
+	    l[0] = l[1] = l[2] = 0;
+	    for (long i = p * vertPerPage; i < min((long)n, (p + 1) * vertPerPage); i++) {
+		l[0]++;
+		l[1] += GA.V[i].getInDegree();
+		l[2] += GA.V[i].getOutDegree();
+	    }
+	}}
+    for (long p = 1; p <= numPages; p++) {
+	for (int c = 0; c < 3; c++) prefix[3 * p + c] += prefix[3 * (p - 1) + c];
+    }
+    // scale turns a load into its weighted ratio to the average share
+    double scale[3], hi = 0;
+    for (int c = 0; c < 3; c++) {
+	long total = prefix[3 * numPages + c];
+	scale[c] = (total > 0 && weights[c] > 0) ? weights[c] * numOfShards / total : 0;
+	hi = max(hi, weights[c] * numOfShards);
+    }
+
+    double lo = 0;
+    for (int iter = 0; iter < 50; iter++) {
+	double mid = (lo + hi) / 2;
+	long p = 0;
+	for (int k = 0; k < numOfShards && p < numPages; k++) p = furthestCut(prefix, numPages, p, scale, mid);
+	if (p == numPages) hi = mid;
+	else lo = mid;
+    }
+
+    long p = 0;
+    for (int k = 0; k < numOfShards; k++) {
+	long next = (k == numOfShards - 1) ? numPages : furthestCut(prefix, numPages, p, scale, hi);
+	sizeArr[k] = min((long)n, next * vertPerPage) - min((long)n, p * vertPerPage);
+	p = next;
+    }
+    free(prefix);
+    reportPartition(GA, numOfShards, sizeArr, sizeOfOneEle);
+}
 
-    int shardSize = n / numOfShards;
+template <class vertex>
+void subPartitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false, bool useFakeDegree=false) {
+    const intT n = GA.n;
+    long *degrees = newA(long, n);
 
     if (useFakeDegree) {
 	{parallel_for(intT i = 0; i < n; i++) degrees[i] = GA.V[i].getFakeDegree();}
@@ -208,40 +316,20 @@ void subPartitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int s
 	}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
+    long *prefix = newA(long, n + 1);
+    blockPrefix(degrees, n, 1, prefix);
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, n, numOfShards, cuts, false);
+    cutsToSizes(cuts, numOfShards, n, 1, sizeArr);
 
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
-
-    int averageDegree = totalDegree / numOfShards;
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i++) {
-	accum[counter] += degrees[i];
-	sizeArr[counter]++;
-	tmpSizeCounter++;
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    counter++;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
-    
+    free(prefix);
     free(degrees);
 }
 
 template <class vertex>
 void subPartitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int sizeOfOneEle, int subStart, int subEnd, bool useOutDegree=false, bool useFakeDegree=false) {
     const intT n = subEnd - subStart;
-    int *degrees = newA(int, n);
-
-    int shardSize = n / numOfShards;
+    long *degrees = newA(long, n);
 
     if (useFakeDegree) {
 	{parallel_for(intT i = subStart; i < subEnd; i++) degrees[i-subStart] = GA.V[i].getFakeDegree();}
@@ -253,31 +341,13 @@ void subPartitionByDegree(graph<vertex> GA, int numOfShards, int *sizeArr, int s
 	}
     }
 
-    int accum[numOfShards];
-    for (int i = 0; i < numOfShards; i++) {
-	accum[i] = 0;
-	sizeArr[i] = 0;
-    }
-
-    long totalDegree = 0;
-    for (intT i = 0; i < n; i++) {
-	totalDegree += degrees[i];
-    }
+    long *prefix = newA(long, n + 1);
+    blockPrefix(degrees, n, 1, prefix);
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, n, numOfShards, cuts, false);
+    cutsToSizes(cuts, numOfShards, n, 1, sizeArr);
 
-    int averageDegree = totalDegree / numOfShards;
-    int counter = 0;
-    int tmpSizeCounter = 0;
-    for (intT i = 0; i < n; i++) {
-	accum[counter] += degrees[i];
-	sizeArr[counter]++;
-	tmpSizeCounter++;
-	if (accum[counter] >= averageDegree && counter < numOfShards - 1) {
-	    counter++;
-	    //cout << tmpSizeCounter / (double)(PAGESIZE / sizeOfOneEle) << endl;
-	    tmpSizeCounter = 0;
-	}
-    }
-    
+    free(prefix);
     free(degrees);
 }
 
@@ -333,7 +403,8 @@ void graphAllEdgeHasher(graph<vertex> &GA, Hash_F hash) {
 	    }
 	    d = V[i].getInDegree();
 	    intE *inEdges = V[i].getInNeighborPtr();
-	    for (intT j = 0; j < d; j++) {
+	    // symmetric vertices share one list, which is relabeled already
+	    for (intT j = 0; j < d && inEdges != outEdges; j++) {
 		inEdges[j] = hash.hashFunc(inEdges[j]);
 	    }
 	    newVertexSet[hash.hashFunc(i)] = V[i];	    
@@ -343,6 +414,243 @@ void graphAllEdgeHasher(graph<vertex> &GA, Hash_F hash) {
     free(V);
 }
 
+// Pipelined loader for the versioned binary format: the graph comes out
+// already relabeled by Hash_F and laid out by partitionByDegree, as if
+// graphAllEdgeHasher and partitionByDegree had been run after loading.
+//
+// Only the offset sections are read up front; they give every degree, so
+// the hashed layout and the partition are fixed before any edge arrives.
+// Reader threads then pread the edge sections block by block into a
+// bounded queue while router threads take the blocks, relabel both ends
+// with Hash_F and write each edge into the array of the node owning its
+// vertex. Reads, relabeling and page placement overlap instead of running
+// one after another. Each block's share of the section checksum is added
+// up by the routers and checked at the end.
+
+#define PIPE_BLOCK_BYTES (1L << 22)
+#define PIPE_QUEUE_DEPTH 16
+#define PIPE_READERS 4
+
+struct pipeBlock {
+    int dir;   // 0 for out-edges, 1 for in-edges
+    long start; // index of the first edge of the block in its section
+    long len;
+    intE *buf;
+};
+
+// bounded FIFO of blocks; pop returns false once it is empty and every
+// producer has called producerDone
+struct pipeQueue {
+    pipeBlock *slots;
+    int cap, head, count, producers;
+    pthread_mutex_t mut;
+    pthread_cond_t notEmpty, notFull;
+    void init(int _cap, int _producers) {
+	slots = newA(pipeBlock, _cap);
+	cap = _cap; head = 0; count = 0; producers = _producers;
+	pthread_mutex_init(&mut, NULL);
+	pthread_cond_init(&notEmpty, NULL);
+	pthread_cond_init(&notFull, NULL);
+    }
+    void push(pipeBlock b) {
+	pthread_mutex_lock(&mut);
+	while (count == cap) pthread_cond_wait(&notFull, &mut);
+	slots[(head + count++) % cap] = b;
+	pthread_cond_signal(&notEmpty);
+	pthread_mutex_unlock(&mut);
+    }
+    bool pop(pipeBlock &b) {
+	pthread_mutex_lock(&mut);
+	while (count == 0 && producers > 0) pthread_cond_wait(&notEmpty, &mut);
+	bool ok = count > 0;
+	if (ok) {
+	    b = slots[head];
+	    head = (head + 1) % cap;
+	    count--;
+	    pthread_cond_signal(&notFull);
+	}
+	pthread_mutex_unlock(&mut);
+	return ok;
+    }
+    void producerDone() {
+	pthread_mutex_lock(&mut);
+	producers--;
+	pthread_cond_broadcast(&notEmpty);
+	pthread_mutex_unlock(&mut);
+    }
+    void del() {
+	free(slots);
+	pthread_mutex_destroy(&mut);
+	pthread_cond_destroy(&notEmpty);
+	pthread_cond_destroy(&notFull);
+    }
+};
+
+template <class Hash_F>
+struct pipeState {
+    int fd;
+    binGraphHeader *h;
+    Hash_F *hash;
+    long *offsets[2];    // file order
+    long *newOffsets[2]; // hashed order
+    intE *edges[2];
+    long numBlocks[2];
+    long nextBlock;
+    bool failed;
+    uint64_t checksum[2];
+    pipeQueue freeBufs, fullBufs;
+};
+
+template <class Hash_F>
+void *pipeReader(void *arg) {
+    pipeState<Hash_F> *st = (pipeState<Hash_F> *)arg;
+    const long perBlock = PIPE_BLOCK_BYTES / sizeof(intE);
+    pipeBlock b;
+    while (st->freeBufs.pop(b)) {
+	long k = __sync_fetch_and_add(&st->nextBlock, 1);
+	if (k >= st->numBlocks[0] + st->numBlocks[1]) {
+	    st->freeBufs.push(b);
+	    break;
+	}
+	b.dir = (k < st->numBlocks[0]) ? 0 : 1;
+	if (b.dir == 1) k -= st->numBlocks[0];
+	binSection &s = st->h->sections[b.dir == 0 ? BIN_OUT_EDGES : BIN_IN_EDGES];
+	b.start = k * perBlock;
+	b.len = min(perBlock, (long)(s.length / sizeof(intE)) - b.start);
+	long done = 0, bytes = b.len * sizeof(intE);
+	while (done < bytes) {
+	    long r = pread(st->fd, (char *)b.buf + done, bytes - done, s.offset + b.start * sizeof(intE) + done);
+	    if (r <= 0) { st->failed = true; break; }
+	    done += r;
+	}
+	st->fullBufs.push(b);
+    }
+    st->fullBufs.producerDone();
+    return NULL;
+}
+
+template <class Hash_F>
+void *pipeRouter(void *arg) {
+    pipeState<Hash_F> *st = (pipeState<Hash_F> *)arg;
+    pipeBlock b;
+    while (st->fullBufs.pop(b)) {
+	__sync_fetch_and_add(&st->checksum[b.dir], binChecksum(b.buf, b.len * sizeof(intE), b.start * sizeof(intE) / sizeof(uint32_t)));
+	long *off = st->offsets[b.dir];
+	long *newOff = st->newOffsets[b.dir];
+	intE *out = st->edges[b.dir];
+	// the vertex holding the block's first edge
+	long src = (upper_bound(off, off + st->h->n + 1, b.start) - off) - 1;
+	for (long e = b.start; e < b.start + b.len; e++) {
+	    while (off[src + 1] <= e) src++;
+	    long pos = newOff[st->hash->hashFunc(src)] + (e - off[src]);
+	    out[pos] = st->hash->hashFunc(b.buf[e - b.start]);
+	}
+	st->freeBufs.push(b);
+    }
+    return NULL;
+}
+
+// Loads fileName hashed by Hash_F(n, numOfNodes) and cut into numOfNodes
+// ranges by partitionByDegree, whose sizes are stored in sizeArr. Each
+// range's edges are placed on its node.
+template <class vertex, class Hash_F>
+graph<vertex> streamGraphFromBin(char *fileName, bool symmetric, int numOfNodes, intT *sizeArr, int sizeOfOneEle) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+	cout << "Unable to open file: " << fileName << endl;
+	abort();
+    }
+    binGraphHeader h = readBinHeader(fd, fileName);
+    if (h.flags & BIN_FLAG_WEIGHTED) {
+	cout << fileName << " is weighted, load it as a wghGraph" << endl;
+	abort();
+    }
+    checkBinSymmetry(h, fileName, symmetric);
+    const intT n = h.n;
+    const int numDirs = symmetric ? 1 : 2;
+    Hash_F hash(n, numOfNodes);
+
+    pipeState<Hash_F> st;
+    st.fd = fd;
+    st.h = &h;
+    st.hash = &hash;
+    st.offsets[0] = (long *)readBinSection(fd, h, BIN_OUT_OFFSETS, fileName);
+    st.offsets[1] = symmetric ? NULL : (long *)readBinSection(fd, h, BIN_IN_OFFSETS, fileName);
+
+    vertex *V = newA(vertex, n);
+    {parallel_for (intT i = 0; i < n; i++) {
+	    intT j = hash.hashFunc(i);
+	    intT d = st.offsets[0][i+1] - st.offsets[0][i];
+	    V[j].setOutDegree(d);
+	    V[j].setFakeDegree(d);
+	    V[j].setInDegree(symmetric ? d : st.offsets[1][i+1] - st.offsets[1][i]);
+	}}
+    partitionByDegree(graph<vertex>(V, n, h.m), numOfNodes, sizeArr, sizeOfOneEle);
+
+    long mapSize[2] = {0, 0};
+    for (int d = 0; d < 2; d++) {
+	st.newOffsets[d] = NULL;
+	st.edges[d] = NULL;
+	st.numBlocks[d] = 0;
+	st.checksum[d] = 0;
+    }
+    const long perBlock = PIPE_BLOCK_BYTES / sizeof(intE);
+    for (int d = 0; d < numDirs; d++) {
+	long *newOff = newA(long, n + 1);
+	{parallel_for (intT j = 0; j < n; j++) newOff[j] = (d == 0) ? V[j].getOutDegree() : V[j].getInDegree();}
+	newOff[n] = sequence::plusScan(newOff, newOff, n);
+	st.newOffsets[d] = newOff;
+	st.edges[d] = numaInEdgeAlloc(numOfNodes, sizeArr, 1, &mapSize[d])(newOff, n, newOff[n]);
+	st.numBlocks[d] = (newOff[n] + perBlock - 1) / perBlock;
+	{parallel_for (intT j = 0; j < n; j++) {
+		if (d == 0) V[j].setOutNeighbors(st.edges[0] + newOff[j]);
+		else V[j].setInNeighbors(st.edges[1] + newOff[j]);
+	    }}
+    }
+
+    int numRouters = max(1, numa_num_configured_cpus() - PIPE_READERS);
+    st.nextBlock = 0;
+    st.failed = false;
+    // the free list never runs dry for good: routers hand every buffer back
+    st.freeBufs.init(PIPE_QUEUE_DEPTH, 1);
+    st.fullBufs.init(PIPE_QUEUE_DEPTH, PIPE_READERS);
+    intE *bufs = newA(intE, perBlock * PIPE_QUEUE_DEPTH);
+    for (int i = 0; i < PIPE_QUEUE_DEPTH; i++) {
+	pipeBlock b = pipeBlock();
+	b.buf = bufs + i * perBlock;
+	st.freeBufs.push(b);
+    }
+    pthread_t tids[PIPE_READERS + numRouters];
+    for (int i = 0; i < PIPE_READERS; i++)
+	pthread_create(&tids[i], NULL, pipeReader<Hash_F>, (void *)&st);
+    for (int i = 0; i < numRouters; i++)
+	pthread_create(&tids[PIPE_READERS + i], NULL, pipeRouter<Hash_F>, (void *)&st);
+    for (int i = 0; i < PIPE_READERS + numRouters; i++)
+	pthread_join(tids[i], NULL);
+    free(bufs);
+    st.freeBufs.del();
+    st.fullBufs.del();
+    close(fd);
+
+    for (int d = 0; d < numDirs; d++) {
+	int sec = (d == 0) ? BIN_OUT_EDGES : BIN_IN_EDGES;
+	if (st.failed || st.checksum[d] != h.sections[sec].checksum) {
+	    cout << fileName << ": section " << sec << " is corrupt" << endl;
+	    abort();
+	}
+	free(st.offsets[d]);
+	free(st.newOffsets[d]);
+    }
+    if (symmetric) {
+	{parallel_for (intT j = 0; j < n; j++) V[j].setInNeighbors(V[j].getOutNeighborPtr());}
+    }
+    cout << "n = " << n << " m = " << h.m << " (streamed)" << endl;
+    graph<vertex> G(V, n, h.m, st.edges[0], st.edges[1]);
+    G.allocatedMapSize = mapSize[0];
+    G.inEdgesMapSize = mapSize[1];
+    return G;
+}
+
 template <class vertex>
 graph<vertex> graphFilter(graph<vertex> &GA, int rangeLow, int rangeHi, bool useOutEdge=true) {
     vertex *V = GA.V;
@@ -404,7 +712,7 @@ graph<vertex> graphFilter(graph<vertex> &GA, int rangeLow, int rangeHi, bool use
 }
 
 template <class vertex>
-graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi) {
+graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi, intT *hubIndex = NULL) {
     vertex *V = GA.V;
     vertex *newVertexSet = (vertex *)numa_alloc_local(sizeof(vertex) * GA.n);
     int *counters = (int *)numa_alloc_local(sizeof(int) * GA.n);
@@ -419,7 +727,7 @@ graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi
 	    counters[i] = 0;
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getOutNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi)
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi))
 		    counters[i]++;
 	    }
 	    newVertexSet[i].setFakeDegree(counters[i]);
@@ -428,7 +736,7 @@ graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi
 	    inCounters[i] = 0;
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getInNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi)
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi))
 		    inCounters[i]++;
 	    }
 	    newVertexSet[i].setFakeDegree(counters[i]);
@@ -459,7 +767,7 @@ graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi
 	    intT d = V[i].getOutDegree();
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getOutNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi) {
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) {
 		    localEdges[counter] = ngh;
 		    counter++;
 		}
@@ -473,7 +781,7 @@ graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi
 	    d = V[i].getInDegree();
 	    for (intT j = 0; j < d; j++) {
 		intT ngh = V[i].getInNeighbor(j);
-		if (rangeLow <= ngh && ngh < rangeHi) {
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) {
 		    localInEdges[counter] = ngh;
 		    counter++;
 		}
@@ -496,6 +804,275 @@ graph<vertex> graphFilter2Direction(graph<vertex> &GA, int rangeLow, int rangeHi
     return graph<vertex>(newVertexSet, GA.n, GA.m);
 }
 
+// Doubly compressed (DCSR-like) local graph of one node. graphFilter and
+// graphFilter2Direction keep a vertex for every one of the n vertices on
+// every node, most of them without a local edge; here only the vertices
+// with local edges in either direction get a row. Rows are ordered by id,
+// so the dense loops walk the rows of a range and the sparse ones find a
+// vertex by binary search. The full out-degrees of the node's own range,
+// which the frontier statistics need, are kept separately.
+template <class vertex>
+struct compactGraph {
+    vertex *V;          // one per row, with full and local (fake) degrees
+    intT *ids;          // id of each row, ascending
+    intT numRows;
+    intT n;             // vertices of the whole graph
+    uintT m;
+    int rangeLow;
+    int rangeHi;
+    intT *rangeDegrees; // out-degree of every vertex in [rangeLow, rangeHi)
+    intE *edges;
+    intE *inEdges;
+    long numEdges;
+    long numInEdges;
+
+    // first row whose id is not below id
+    inline intT firstRow(intT id) {
+	return lower_bound(ids, ids + numRows, id) - ids;
+    }
+
+    // the row of id, NULL when it has no local edge
+    inline vertex *find(intT id) {
+	intT r = firstRow(id);
+	return (r < numRows && ids[r] == id) ? &V[r] : NULL;
+    }
+
+    inline intT getOutDegree(intT id) {
+	if (rangeLow <= id && id < rangeHi)
+	    return rangeDegrees[id - rangeLow];
+	vertex *v = find(id);
+	return (v != NULL) ? v->getOutDegree() : 0;
+    }
+
+    void del() {
+	numa_free(V, sizeof(vertex) * (numRows + 1));
+	numa_free(ids, sizeof(intT) * (numRows + 1));
+	numa_free(rangeDegrees, sizeof(intT) * (rangeHi - rangeLow + 1));
+	numa_free(edges, sizeof(intE) * (numEdges + 1));
+	numa_free(inEdges, sizeof(intE) * (numInEdges + 1));
+    }
+};
+
+// Builds the compact local graph of [rangeLow, rangeHi), keeping the same
+// edges as graphFilter2Direction; hubIndex, when set, selects the hybrid cut
+// (see hub-mirror.h). Only the counting pass uses n-sized (temporary) arrays.
+template <class vertex>
+compactGraph<vertex> graphFilterCompact(graph<vertex> &GA, int rangeLow, int rangeHi, intT *hubIndex = NULL) {
+    vertex *V = GA.V;
+    const intT n = GA.n;
+    intT *counters = newA(intT, n);
+    intT *inCounters = newA(intT, n);
+    intT *rowOf = newA(intT, n);
+    {parallel_for (intT i = 0; i < n; i++) {
+	    intT c = 0, inC = 0;
+	    intT d = V[i].getOutDegree();
+	    for (intT j = 0; j < d; j++) {
+		if (keepsNeighbor(hubIndex, i, V[i].getOutNeighbor(j), rangeLow, rangeHi)) c++;
+	    }
+	    d = V[i].getInDegree();
+	    for (intT j = 0; j < d; j++) {
+		if (keepsNeighbor(hubIndex, i, V[i].getInNeighbor(j), rangeLow, rangeHi)) inC++;
+	    }
+	    counters[i] = c;
+	    inCounters[i] = inC;
+	    rowOf[i] = (c + inC > 0) ? 1 : 0;
+	}}
+    intT numRows = sequence::plusScan(rowOf, rowOf, n);
+
+    compactGraph<vertex> G;
+    G.n = n;
+    G.m = GA.m;
+    G.numRows = numRows;
+    G.rangeLow = rangeLow;
+    G.rangeHi = rangeHi;
+    G.V = (vertex *)numa_alloc_local(sizeof(vertex) * (numRows + 1));
+    G.ids = (intT *)numa_alloc_local(sizeof(intT) * (numRows + 1));
+    G.rangeDegrees = (intT *)numa_alloc_local(sizeof(intT) * (rangeHi - rangeLow + 1));
+    long *offsets = newA(long, numRows + 1);
+    long *inOffsets = newA(long, numRows + 1);
+    {parallel_for (intT i = 0; i < n; i++) {
+	    if (counters[i] + inCounters[i] > 0) {
+		intT r = rowOf[i];
+		G.ids[r] = i;
+		offsets[r] = counters[i];
+		inOffsets[r] = inCounters[i];
+	    }
+	}}
+    {parallel_for (intT i = rangeLow; i < rangeHi; i++) G.rangeDegrees[i - rangeLow] = V[i].getOutDegree();}
+    free(counters);
+    free(inCounters);
+    free(rowOf);
+    G.numEdges = sequence::plusScan(offsets, offsets, (long)numRows);
+    G.numInEdges = sequence::plusScan(inOffsets, inOffsets, (long)numRows);
+    G.edges = (intE *)numa_alloc_local(sizeof(intE) * (G.numEdges + 1));
+    G.inEdges = (intE *)numa_alloc_local(sizeof(intE) * (G.numInEdges + 1));
+
+    {parallel_for (intT r = 0; r < numRows; r++) {
+	    intT i = G.ids[r];
+	    intE *localEdges = G.edges + offsets[r];
+	    intE *localInEdges = G.inEdges + inOffsets[r];
+	    intT counter = 0;
+	    intT d = V[i].getOutDegree();
+	    for (intT j = 0; j < d; j++) {
+		intT ngh = V[i].getOutNeighbor(j);
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) localEdges[counter++] = ngh;
+	    }
+	    intT inCounter = 0;
+	    d = V[i].getInDegree();
+	    for (intT j = 0; j < d; j++) {
+		intT ngh = V[i].getInNeighbor(j);
+		if (keepsNeighbor(hubIndex, i, ngh, rangeLow, rangeHi)) localInEdges[inCounter++] = ngh;
+	    }
+	    G.V[r].setOutDegree(V[i].getOutDegree());
+	    G.V[r].setInDegree(V[i].getInDegree());
+	    G.V[r].setFakeDegree(counter);
+	    G.V[r].setFakeInDegree(inCounter);
+	    G.V[r].setOutNeighbors(localEdges);
+	    G.V[r].setInNeighbors(localInEdges);
+	}}
+    free(offsets);
+    free(inOffsets);
+    printf("compact local graph: %d of %d vertices, %ld out %ld in edges\n", numRows, n, G.numEdges, G.numInEdges);
+    return G;
+}
+
+// subPartitionByDegree over the local (fake) degrees of a compact graph,
+// giving the same cuts as on the n-sized local graph: only rows carry
+// degree, so a shard still ends right after the row that brings it to the
+// average. Cuts are ids of the whole graph, as the dense ranges expect.
+// The degrees are always the local ones, so unlike the graph overloads
+// there is no useFakeDegree.
+template <class vertex>
+void subPartitionByDegree(compactGraph<vertex> &GA, int numOfShards, int *sizeArr, int sizeOfOneEle, bool useOutDegree=false) {
+    const intT n = GA.n;
+    const intT rows = GA.numRows;
+    long *prefix = newA(long, rows + 1);
+    {parallel_for (intT r = 0; r < rows; r++) {
+	    prefix[r] = useOutDegree ? GA.V[r].getFakeDegree() : GA.V[r].getFakeInDegree();
+	}}
+    prefix[rows] = sequence::plusScan(prefix, prefix, (long)rows);
+    long average = prefix[rows] / numOfShards;
+    long cuts[numOfShards + 1];
+    cutPrefix(prefix, rows, numOfShards, cuts, false);
+
+    intT prev = 0;
+    for (int k = 0; k < numOfShards; k++) {
+	intT end = n;
+	if (average == 0) {
+	    // every vertex reaches the average: one per shard, the last takes the rest
+	    end = (k < numOfShards - 1) ? min((intT)(k + 1), n) : n;
+	} else if (k < numOfShards - 1 && cuts[k + 1] > cuts[k] &&
+		   prefix[cuts[k + 1]] - prefix[cuts[k]] >= average) {
+	    end = GA.ids[cuts[k + 1] - 1] + 1;
+	}
+	end = max(end, prev);
+	sizeArr[k] = end - prev;
+	prev = end;
+    }
+    free(prefix);
+}
+
+// collects the neighbors of one direction of vertex id that the local graph
+// of [rangeLow, rangeHi) keeps, sorted, into buf; returns how many there are
+template <class vertex>
+intT collectSortedNeighbors(vertex &v, intT id, bool out, int rangeLow, int rangeHi, intT *hubIndex, intE *buf) {
+    intT d = out ? v.getOutDegree() : v.getInDegree();
+    intT counter = 0;
+    for (intT j = 0; j < d; j++) {
+	intT ngh = out ? v.getOutNeighbor(j) : v.getInNeighbor(j);
+	if (keepsNeighbor(hubIndex, id, ngh, rangeLow, rangeHi))
+	    buf[counter++] = ngh;
+    }
+    sort(buf, buf + counter);
+    return counter;
+}
+
+#define COMPRESS_BLOCK (1024) // vertices per task when compressing
+
+// Same as graphFilter2Direction, but the neighbor lists of the result are
+// compressed (see compressedNeighborIter); cvertex is one of the
+// compressed vertex types.
+template <class cvertex, class vertex>
+graph<cvertex> graphFilter2DirectionCompressed(graph<vertex> &GA, int rangeLow, int rangeHi, intT *hubIndex = NULL) {
+    vertex *V = GA.V;
+    const intT n = GA.n;
+    cvertex *newVertexSet = (cvertex *)numa_alloc_local(sizeof(cvertex) * n);
+    long *offsets = (long *)numa_alloc_local(sizeof(long) * (n + 1));
+    long *inOffsets = (long *)numa_alloc_local(sizeof(long) * (n + 1));
+
+    long blocks = (n + COMPRESS_BLOCK - 1) / COMPRESS_BLOCK;
+    for (int pass = 0; pass < 2; pass++) {
+	unsigned char *bytes = NULL, *inBytes = NULL;
+	if (pass == 1) {
+	    offsets[n] = inOffsets[n] = 0;
+	    long totalSize = sequence::plusScan(offsets, offsets, (long)(n + 1));
+	    long totalInSize = sequence::plusScan(inOffsets, inOffsets, (long)(n + 1));
+	    bytes = (unsigned char *)numa_alloc_local(totalSize + 1);
+	    inBytes = (unsigned char *)numa_alloc_local(totalInSize + 1);
+	    printf("compressed local edges: %ld out %ld in bytes\n", totalSize, totalInSize);
+	}
+	// one neighbor buffer per block of vertices, sized to its largest degree
+	{parallel_for (long k = 0; k < blocks; k++) {
+		intT lo = k * COMPRESS_BLOCK;
+		intT hi = min((long)n, (k + 1) * COMPRESS_BLOCK);
+		intT maxDeg = 0;
+		for (intT i = lo; i < hi; i++)
+		    maxDeg = max(maxDeg, max(V[i].getOutDegree(), V[i].getInDegree()));
+		intE *buf = newA(intE, maxDeg + 1);
+		for (intT i = lo; i < hi; i++) {
+		    intT d = collectSortedNeighbors(V[i], i, true, rangeLow, rangeHi, hubIndex, buf);
+		    long b = encodeNeighbors(buf, d, (pass == 1) ? bytes + offsets[i] : NULL);
+		    intT inD = collectSortedNeighbors(V[i], i, false, rangeLow, rangeHi, hubIndex, buf);
+		    long inB = encodeNeighbors(buf, inD, (pass == 1) ? inBytes + inOffsets[i] : NULL);
+		    if (pass == 0) {
+			offsets[i] = b;
+			inOffsets[i] = inB;
+		    } else {
+			newVertexSet[i].setOutDegree(V[i].getOutDegree());
+			newVertexSet[i].setInDegree(V[i].getInDegree());
+			newVertexSet[i].setFakeDegree(d);
+			newVertexSet[i].setFakeInDegree(inD);
+			newVertexSet[i].setOutBytes(bytes + offsets[i]);
+			newVertexSet[i].setInBytes(inBytes + inOffsets[i]);
+		    }
+		}
+		free(buf);
+	    }}
+    }
+    numa_free(offsets, sizeof(long) * (n + 1));
+    numa_free(inOffsets, sizeof(long) * (n + 1));
+    return graph<cvertex>(newVertexSet, n, GA.m);
+}
+
+// builds the local graph of one node in the representation of out's type;
+// hubIndex, when set, selects the hybrid cut (see hub-mirror.h)
+template <class vertex>
+void buildLocalGraph(graph<vertex> &GA, int rangeLow, int rangeHi, graph<vertex> &out, intT *hubIndex = NULL) {
+    out = graphFilter2Direction(GA, rangeLow, rangeHi, hubIndex);
+}
+
+template <class vertex>
+void buildLocalGraph(graph<vertex> &GA, int rangeLow, int rangeHi, graph<compressedAsymmetricVertex> &out, intT *hubIndex = NULL) {
+    out = graphFilter2DirectionCompressed<compressedAsymmetricVertex>(GA, rangeLow, rangeHi, hubIndex);
+}
+
+template <class vertex>
+void buildLocalGraph(graph<vertex> &GA, int rangeLow, int rangeHi, graph<compressedSymmetricVertex> &out, intT *hubIndex = NULL) {
+    out = graphFilter2DirectionCompressed<compressedSymmetricVertex>(GA, rangeLow, rangeHi, hubIndex);
+}
+
+// loads the local graph of a node from its shard file (see loadGraphShard)
+template <class vertex>
+void loadLocalGraph(char *prefix, int shardID, int numOfShards, graph<vertex> &out) {
+    out = loadGraphShard<vertex>(prefix, shardID, numOfShards);
+}
+
+void loadLocalGraph(char *prefix, int shardID, int numOfShards, graph<compressedAsymmetricVertex> &out) {
+    graph<asymmetricVertex> plain = loadGraphShard<asymmetricVertex>(prefix, shardID, numOfShards);
+    out = graphFilter2DirectionCompressed<compressedAsymmetricVertex>(plain, 0, plain.n);
+    freeGraphShard(plain);
+}
+
 void *mapDataArray(int numOfShards, int *sizeArr, int sizeOfOneEle) {
     int numOfPages = 0;
     for (int i = 0; i < numOfShards; i++) {	
@@ -535,7 +1112,24 @@ struct LocalFrontier {
     int startID;
     int endID;
     bool *b;
+    // bit-packed instead of b when not NULL (see bitmap.h); only kernels
+    // going through getBit/setBit, not getArr/getNextArr, accept it
+    uint64_t *bits;
+    // one bit per word of bits, set with any bit of the word (see bitmap.h)
+    uint64_t *summary;
     intT *s;
+    intT sCap;
+    bool sInArena;       // s was drawn from arena rather than malloc
+    // scratch memory dropped by clearFrontier (see frontier-arena.h): arena
+    // for the submaster, subArenas for each subworker once a kernel needs them
+    frontierArena arena;
+    frontierArena *subArenas;
+    int numOfArenas;
+    // per-subworker output of edgeMapSparseV3 (see sparse-chunk.h)
+    sparseChunk *chunks;
+    // remDups: the round in which each vertex of the range was last added
+    unsigned *claims;
+    unsigned claimRound;
     intT sparseCounter;
     intT **sparseChunks;
     intT *chunkSizes;
@@ -543,20 +1137,57 @@ struct LocalFrontier {
     AsyncChunk **localQueue;
     bool isDense;
     
-    LocalFrontier(bool *_b, int start, int end):b(_b), startID(start), endID(end), n(end - start), m(0), isDense(true), s(NULL), outEdgesCount(0), sparseChunks(NULL), chunkSizes(NULL){}
+    LocalFrontier(bool *_b, int start, int end):n(end - start), m(0), outEdgesCount(0), startID(start), endID(end), b(_b), bits(NULL), summary(NULL), s(NULL), sCap(0), sInArena(false), arena(arenaLocalNode()), subArenas(NULL), numOfArenas(0), chunks(NULL), claims(NULL), claimRound(0), sparseChunks(NULL), chunkSizes(NULL), isDense(true){}
+    LocalFrontier(uint64_t *_bits, int start, int end):n(end - start), m(0), outEdgesCount(0), startID(start), endID(end), b(NULL), bits(_bits), summary(newBitmapSummary(_bits, end - start)), s(NULL), sCap(0), sInArena(false), arena(arenaLocalNode()), subArenas(NULL), numOfArenas(0), chunks(NULL), claims(NULL), claimRound(0), sparseChunks(NULL), chunkSizes(NULL), isDense(true){}
     
     bool inRange(int index) { return (startID <= index && index < endID);}
-    inline void setBit(int index, bool val) { b[index-startID] = val;}
-    inline bool getBit(int index) { return b[index-startID];}
+    inline void setBit(int index, bool val) {
+	if (bits == NULL) b[index-startID] = val;
+	else if (val) bitmapSetSummarized(bits, summary, index-startID);
+	else bitmapSet(bits, index-startID, false);
+    }
+    inline bool getBit(int index) {
+	return (bits != NULL) ? bitmapGet(bits, index-startID) : b[index-startID];
+    }
+
+    // whether no vertex of the summary span holding index can be set;
+    // always false for bool frontiers
+    inline bool spanEmpty(int index) {
+	return bits != NULL && bitmapSummaryWord(summary, index-startID) == 0;
+    }
+
+    // the first id of the summary span after the one holding index
+    inline int nextSpan(int index) {
+	return min(endID, startID + ((index-startID) / BITMAP_SUMMARY_SPAN + 1) * BITMAP_SUMMARY_SPAN);
+    }
+
+    // the ids of the set bits, ascending, in a list drawn from alloc
+    template <class Alloc>
+    _seq<intT> packDense(Alloc alloc) {
+	if (bits != NULL) {
+	    intT cnt;
+	    intT *A = bitmapPack(bits, n, startID, &cnt, summary, alloc);
+	    return _seq<intT>(A, cnt);
+	}
+	return flagsPack(b, n, startID, alloc);
+    }
+
+    void clearDense() {
+	if (bits != NULL) {
+	    bitmapClearSummarized(bits, summary, 0, bitmapSummaryWords(n));
+	} else {
+	    {parallel_for(intT i=0;i<n;i++) b[i] = false;}
+	}
+    }
 
     void toSparse() {
 	if (isDense) {
-	    if (s != NULL)
-		free(s);
-	    _seq<intT> R = sequence::packIndex(b, n);
+	    releaseSparse();
+	    _seq<intT> R = packDense(arenaIntAlloc(&arena));
 	    s = R.A;
 	    m = R.n;
-	    {parallel_for (intT i = 0; i < m; i++) s[i] = s[i] + startID;}
+	    sCap = m;
+	    sInArena = true;
 	    if (m == 0) {
 		printf("%p\n", s);
 	    } else {
@@ -566,14 +1197,15 @@ struct LocalFrontier {
 	isDense = false;
     }
 
+    // the list is also queued on next as an AsyncChunk, which outlives
+    // this frontier's arena, so it stays on malloc
     void toSparseAsync(int nextID, LocalFrontier* next) {
 	if (isDense) {
-	    if (s != NULL)
-		free(s);
-	    _seq<intT> R = sequence::packIndex(b, n);
+	    releaseSparse();
+	    _seq<intT> R = packDense(mallocIntAlloc());
 	    s = R.A;
 	    m = R.n;
-	    {parallel_for (intT i = 0; i < m; i++) s[i] = s[i] + startID;}
+	    sCap = m;
 	    if (m == 0) {
 		printf("%p\n", s);
 	    } else {
@@ -593,8 +1225,8 @@ struct LocalFrontier {
     
     void toDense() {
 	if (!isDense) {
-	    {parallel_for(intT i=0;i<n;i++) b[i] = false;}
-	    {parallel_for(intT i=0;i<m;i++) b[s[i] - startID] = true;}
+	    clearDense();
+	    {parallel_for(intT i=0;i<m;i++) setBit(s[i], true);}
 	}
 	//printf("hehe\n");
 	isDense = true;
@@ -602,11 +1234,11 @@ struct LocalFrontier {
     
     void toDenseWithMerge(int numOfSub) {
 	if (!isDense) {
-	    {parallel_for(intT i=0;i<n;i++) b[i] = false;}
+	    clearDense();
 	    for (int i = 0; i < numOfSub; i++) {
 		intT *sparsePtr = sparseChunks[i];
 		intT size = chunkSizes[i];
-		{parallel_for(intT j=0;j<size;j++) b[sparsePtr[j] - startID] = true;}
+		{parallel_for(intT j=0;j<size;j++) setBit(sparsePtr[j], true);}
 	    }
 	}
 	//printf("hehe\n");
@@ -614,27 +1246,100 @@ struct LocalFrontier {
     }
 
     void setSparse(intT _m, intT *_s) {
-	if (s != NULL) {
-	    free(s);
-	}
+	releaseSparse();
 	m = _m;
 	s = _s;
+	sCap = _m;
 	isDense = false;
     }
 
+    void releaseSparse() {
+	if (s != NULL && !sInArena)
+	    free(s);
+	s = NULL;
+	sCap = 0;
+	sInArena = false;
+    }
+
+    // grows s, keeping its first m entries, to hold len; called by the
+    // submaster, the new list comes from arena
+    void reserveSparse(intT len) {
+	if (s != NULL && len <= sCap) return;
+	intT cap = (len < 2 * sCap) ? 2 * sCap : len;
+	intT *A = (intT *)arena.alloc(sizeof(intT) * (cap + 1));
+	if (s != NULL && m > 0)
+	    memcpy(A, s, sizeof(intT) * min(m, sCap));
+	releaseSparse();
+	s = A;
+	sCap = cap;
+	sInArena = true;
+    }
+
+    // creates a subworker arena for each of the node's subworkers; called
+    // by the submaster before the local barrier preceding their use
+    void prepareArenas(int numOfSub) {
+	if (subArenas == NULL)
+	    subArenas = newFrontierArenas(numOfSub, arena.node);
+	numOfArenas = numOfSub;
+    }
+
+    // Starts a round of claim(); called by the submaster before the local
+    // barrier preceding the edgeMap. Stamps are never cleared, a new
+    // round number invalidates them all.
+    void beginClaims() {
+	if (claims == NULL)
+	    claims = (unsigned *)numa_alloc_local(sizeof(unsigned) * (n + 1));
+	if (++claimRound == 0) {
+	    memset(claims, 0, sizeof(unsigned) * (n + 1));
+	    claimRound = 1;
+	}
+    }
+
+    // whether this is the first time v, which must be in the range, is
+    // added this round: the first subworker to stamp it wins
+    inline bool claim(intT v) {
+	unsigned *p = &claims[v - startID];
+	unsigned old = *p;
+	return old != claimRound && __sync_bool_compare_and_swap(p, old, claimRound);
+    }
+
+    // Called by every subworker of the node once its chunk is complete:
+    // concatenates the chunks into s, in subworker order, and sets m.
+    void gatherChunks(Subworker_Partitioner &subworker) {
+	subworker.localWait();
+	if (subworker.isSubMaster()) {
+	    intT total = sparseChunkOffset(chunks, subworker.numOfSub);
+	    reserveSparse(total);
+	    m = total;
+	}
+	subworker.localWait();
+	sparseChunk &out = chunks[subworker.subTid];
+	if (out.n > 0)
+	    memcpy(s + sparseChunkOffset(chunks, subworker.subTid), out.A, sizeof(intT) * out.n);
+    }
+
     bool *swapBitVector(bool *newB) {
 	bool *tmp = b;
 	b = newB;
 	return tmp;
     }
 
+    // the frontier is about to become the next output: its list and
+    // scratch buffers are dropped
     void clearFrontier() {
-	if (s != NULL) {
-	    free(s);
-	}
-	s = NULL;
 	m = 0;
 	outEdgesCount = 0;
+	if (sInArena) {
+	    s = NULL;
+	    sCap = 0;
+	    sInArena = false;
+	}
+	arena.reset();
+	for (int i = 0; subArenas != NULL && i < numOfArenas; i++) {
+	    subArenas[i].reset();
+	    if (chunks != NULL)
+		chunks[i].release();
+	}
     }
 };
 
@@ -645,6 +1350,8 @@ struct vertices {
     intT numOfVertices;
     int *numOfVertexOnNode;
     int *offsets;
+    int ownerShift;
+    int *owner; // node of the first vertex of every 2^ownerShift vertices
     int *numOfNonZero;
     bool** d;
     LocalFrontier **frontiers;
@@ -665,6 +1372,7 @@ struct vertices {
 	offsets = (int *)malloc((numOfNodes + 1) * sizeof(int));
 	numOfNonZero = (int *)malloc(numOfNodes * sizeof(int));
 	numOfVertices = 0;
+	owner = NULL;
 	m = -1;
 	firstSparse = false;
     }
@@ -735,6 +1443,27 @@ struct vertices {
 	}
     }
 
+    // Readies the frontiers for a round in which node i runs dense when
+    // modes[i] is set: bits for dense nodes, lists for sparse ones. When
+    // the nodes disagree every frontier keeps both, as converting one
+    // leaves the other valid. Works frontier by frontier, since the
+    // last round may have left them in different modes.
+    void prepareModes(char *modes) {
+	bool anyDense = false, anySparse = false;
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (modes[i]) anyDense = true;
+	    else anySparse = true;
+	}
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (frontiers[i]->isDense) {
+		if (anySparse) frontiers[i]->toSparse();
+	    } else if (anyDense) {
+		frontiers[i]->toDense();
+	    }
+	}
+	isDense = !anySparse;
+    }
+
     long long getEdgeStat() {
 	long long sum = 0;
 	for (int i = 0; i < numOfNodes; i++) {
@@ -753,6 +1482,34 @@ struct vertices {
 	    //printf("offset of %d: %d\n", i, offsets[i]);
 	}
 	offsets[numOfNodes] = numOfVertices;
+
+	// slots are no wider than the smallest non-empty range, so nodeOf
+	// moves past at most one boundary, plus those of empty nodes
+	int minSize = numOfVertices;
+	for (int i = 0; i < numOfNodes; i++) {
+	    if (numOfVertexOnNode[i] > 0 && numOfVertexOnNode[i] < minSize)
+		minSize = numOfVertexOnNode[i];
+	}
+	ownerShift = 0;
+	while ((2 << ownerShift) <= minSize) ownerShift++;
+	intT slots = (numOfVertices >> ownerShift) + 1;
+	owner = newA(int, slots);
+	int k = 0;
+	for (intT j = 0; j < slots; j++) {
+	    while (k < numOfNodes - 1 && (j << ownerShift) >= offsets[k + 1]) k++;
+	    owner[j] = k;
+	}
+    }
+
+    // node owning a vertex, in constant time
+    inline int nodeOf(intT index) {
+	int k = owner[index >> ownerShift];
+	while (k < numOfNodes - 1 && index >= offsets[k + 1]) k++;
+	return k;
+    }
+
+    inline LocalFrontier *frontierOf(intT index) {
+	return frontiers[nodeOf(index)];
     }
 
     int getSize(int nodeNum) {
@@ -798,11 +1555,7 @@ struct vertices {
     }
 
     int getNodeNumOfIndex(int index) {
-	int result = 0;
-	while (result < numOfNodes && offsets[result] <= index) {
-	    result++;
-	}
-	return result - 1;
+	return nodeOf(index);
     }
 
     int getNodeNumOfSparseIndex(int index) {
@@ -819,24 +1572,13 @@ struct vertices {
 	return offsets[nodeNum];
     }
 
-    void setBit(int index, bool bit) {
-	int accum = 0;
-	int i = 0;
-        while (index >= accum + numOfVertexOnNode[i]) {
-	    accum += numOfVertexOnNode[i];
-	    i++;
-	}
-	*(frontiers[i]->b + (index - accum)) = bit;
+    // the frontiers of all nodes read and written as one
+    inline void setBit(intT index, bool bit) {
+	frontierOf(index)->setBit(index, bit);
     }
 
-    bool getBit(int index) {
-	int accum = 0;
-	int i = 0;
-        while (index >= accum + numOfVertexOnNode[i]) {
-	    accum += numOfVertexOnNode[i];
-	    i++;
-	}
-	return *(frontiers[i]->b + (index - accum));
+    inline bool getBit(intT index) {
+	return frontierOf(index)->getBit(index);
     }
 
     bool *getArr(int nodeNum) {
@@ -875,6 +1617,7 @@ struct vertices {
 
     void del() {
 	free(offsets);
+	if (owner != NULL) free(owner);
 	free(numOfVertexOnNode);
 	free(d);
     }
@@ -954,8 +1697,9 @@ bool* edgeMapDense(graph<vertex> GA, vertices* frontier, F f, LocalFrontier *nex
 	//next->setBit(i, false);
 	if (f.cond(i)) { 
 	    intT d = G[i].getFakeInDegree();
+	    typename vertex::neighborIter it = G[i].getInIter();
 	    for(intT j=0; j<d; j++){
-		intT ngh = G[i].getInNeighbor(j);
+		intT ngh = it.next();
 		if (localBitVec[ngh - localOffset] && f.updateAtomic(ngh,i)) {
 		    currBitVector[i - currOffset] = true;
 		}
@@ -968,7 +1712,7 @@ bool* edgeMapDense(graph<vertex> GA, vertices* frontier, F f, LocalFrontier *nex
 }
 
 template <class F, class vertex>
-bool* edgeMapDenseForward(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, int start = 0, int end = 0) {
+bool* edgeMapDenseForward(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, int start = 0, int end = 0, long *work = NULL) {
     intT numVertices = GA.n;
     vertex *G = GA.V;
 
@@ -981,6 +1725,7 @@ bool* edgeMapDenseForward(graph<vertex> GA, vertices *frontier, F f, LocalFronti
     intT m = 0;
     intT outEdgesCount = 0;
     bool *nextB = next->b;
+    long traversed = 0;
     
     int startPos = 0;
     int endPos = numVertices;
@@ -1005,8 +1750,10 @@ bool* edgeMapDenseForward(graph<vertex> GA, vertices *frontier, F f, LocalFronti
 	m += G[i].getFakeDegree();
 	if (currBitVector[i-currOffset]) {
 	    intT d = G[i].getFakeDegree();
+	    traversed += d;
+	    typename vertex::neighborIter it = G[i].getOutIter();
 	    for(intT j=0; j<d; j++){
-		uintT ngh = G[i].getOutNeighbor(j);
+		uintT ngh = it.next();
 		if (/*next->inRange(ngh) &&*/ f.cond(ngh) && f.updateAtomic(i,ngh)) {
 		    /*
 		    if (!next->getBit(ngh)) {
@@ -1028,6 +1775,44 @@ bool* edgeMapDenseForward(graph<vertex> GA, vertices *frontier, F f, LocalFronti
     //writeAdd(&(next->outEdgesCount), outEdgesCount);
     //printf("edgeMap: %d %d\n", m, outEdgesCount);
 
+    if (work != NULL)
+	*work = (endPos - startPos) + traversed;
+    return NULL;
+}
+
+// edgeMapDenseForward over a compact local graph: only the rows of
+// [start, end) are visited.
+template <class F, class vertex>
+bool* edgeMapDenseForward(compactGraph<vertex> &GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, int start = 0, int end = 0, long *work = NULL) {
+    vertex *G = GA.V;
+    intT startRow = part ? GA.firstRow(start) : 0;
+    intT endRow = part ? GA.firstRow(end) : GA.numRows;
+
+    long traversed = 0;
+    long scanned = 0;
+    for (intT r = startRow; r < endRow; r++) {
+	intT i = GA.ids[r];
+	LocalFrontier *local = frontier->frontierOf(i);
+	if (local->spanEmpty(i)) {
+	    // jump to the first row past the span; the loop's r++ lands on it
+	    r = GA.firstRow(local->nextSpan(i)) - 1;
+	    continue;
+	}
+	scanned++;
+	if (local->getBit(i)) {
+	    intT d = G[r].getFakeDegree();
+	    traversed += d;
+	    typename vertex::neighborIter it = G[r].getOutIter();
+	    for (intT j = 0; j < d; j++) {
+		uintT ngh = it.next();
+		if (f.cond(ngh) && f.updateAtomic(i, ngh)) {
+		    next->setBit(ngh, true);
+		}
+	    }
+	}
+    }
+    if (work != NULL)
+	*work = scanned + traversed;
     return NULL;
 }
 
@@ -1074,8 +1859,9 @@ bool* edgeMapDenseForwardDynamic(graph<vertex> GA, vertices *frontier, F f, Loca
 	    m += G[i].getFakeDegree();
 	    if (currBitVector[i-currOffset]) {
 		intT d = G[i].getFakeDegree();
+		typename vertex::neighborIter it = G[i].getOutIter();
 		for(intT j=0; j<d; j++){
-		    uintT ngh = G[i].getOutNeighbor(j);
+		    uintT ngh = it.next();
 		    if (f.cond(ngh) && f.updateAtomic(i, ngh)) {
 			next->setBit(ngh, true);
 		    }
@@ -1141,8 +1927,9 @@ bool* edgeMapDenseReduce(graph<vertex> GA, vertices* frontier, F f, LocalFrontie
 	    intT d = G[i].getFakeInDegree();
 	    f.initFunc((void *)data, i);
 	    bool shouldActive = false;
+	    typename vertex::neighborIter it = G[i].getInIter();
 	    for(intT j=0; j<d; j++){
-		intT ngh = G[i].getInNeighbor(j);
+		intT ngh = it.next();
 		if (localBitVec[ngh - localOffset] && f.reduceFunc((void *)data, ngh)) {
 		    currBitVector[i - currOffset] = true;
 		    //shouldActive = true;
@@ -1167,6 +1954,45 @@ bool* edgeMapDenseReduce(graph<vertex> GA, vertices* frontier, F f, LocalFrontie
     return NULL;
 }
 
+// edgeMapDenseReduce over a compact local graph; targets without local
+// in-edges have no row and are skipped, as they would change nothing.
+template <class F, class vertex>
+bool* edgeMapDenseReduce(compactGraph<vertex> &GA, vertices* frontier, F f, LocalFrontier *next, bool parallel = 0, Subworker_Partitioner &subworker = dummyPartitioner) {
+    vertex *G = GA.V;
+
+    if (subworker.isSubMaster()) {
+	frontier->nextFrontiers[subworker.tid] = next;
+    }
+
+    subworker.globalWait();
+
+    LocalFrontier *local = frontier->getFrontier(subworker.tid);
+
+    intT startRow = GA.firstRow(subworker.dense_start);
+    intT endRow = GA.firstRow(subworker.dense_end);
+    for (intT r = startRow; r < endRow; r++) {
+	intT i = GA.ids[r];
+	intT d = G[r].getFakeInDegree();
+	if (d > 0 && f.cond(i)) {
+	    LocalFrontier *target = frontier->nextFrontiers[frontier->nodeOf(i)];
+	    double data[2];
+	    f.initFunc((void *)data, i);
+	    typename vertex::neighborIter it = G[r].getInIter();
+	    for (intT j = 0; j < d; j++) {
+		intT ngh = it.next();
+		if (local->getBit(ngh) && f.reduceFunc((void *)data, ngh)) {
+		    target->setBit(i, true);
+		}
+		if (!f.cond(i)) break;
+	    }
+	    f.combineFunc((void *)data, i);
+	}
+    }
+
+    subworker.localWait();
+    return NULL;
+}
+
 template <class F, class vertex>
 bool* edgeMapDenseDynamic(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, Subworker_Partitioner &subworker=dummyPartitioner) {
     intT numVertices = GA.n;
@@ -1237,8 +2063,9 @@ bool* edgeMapDenseDynamic(graph<vertex> GA, vertices *frontier, F f, LocalFronti
 	    if (f.cond(idx)) {
 		intT d = G[idx].getFakeInDegree();
 		//printf("in deg of %d: %d\n", idx, d);
+		typename vertex::neighborIter it = G[idx].getInIter();
 		for(intT j=0; j<d; j++){
-		    uintT ngh = G[idx].getInNeighbor(j);
+		    uintT ngh = it.next();
 		    if (localBitVec[ngh-localOffset] && f.updateAtomic(ngh, idx)) {
 			currBitVector[idx - currOffset] = true;
 		    }
@@ -1293,8 +2120,9 @@ bool* edgeMapDenseBP(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
      	m += G[i].getFakeDegree();
      	if (currBitVector[i-currOffset]) {
      	    intT d = G[i].getFakeDegree();
+     	    typename vertex::neighborIter it = G[i].getOutIter();
      	    for(intT j=0; j<d; j++){
-     		uintT ngh = G[i].getOutNeighbor(j);
+     		uintT ngh = it.next();
      		if (/*next->inRange(ngh) &&*/ f.cond(ngh) && f.updateAtomic(i,ngh,j)) {
      		    next->setBit(ngh, true);
      		}
@@ -1321,23 +2149,16 @@ bool* edgeMapDenseForwardGlobalWrite(graph<vertex> GA, vertices *frontier, F f,
 
     //printf("%d %d: start-end: %d %d\n", subworker.tid, subworker.subTid, startPos, endPos);
 
-    int currNodeNum = frontier->getNodeNumOfIndex(startPos);
-    bool *nextBitVector = nexts[currNodeNum]->b;
-    intT nextSwitchPoint = frontier->getOffset(currNodeNum+1);
-    int offset = frontier->getOffset(currNodeNum);
-
     for (long i=startPos; i<endPos; i++){
-	if (i == nextSwitchPoint) {
-	    offset += frontier->getSize(currNodeNum);
-	    nextSwitchPoint += frontier->getSize(currNodeNum + 1);
-	    currNodeNum++;
-	    nextBitVector = nexts[currNodeNum]->b;
-	}
+	LocalFrontier *target = nexts[frontier->nodeOf(i)];
+	bool *nextBitVector = target->b;
+	int offset = target->startID;
 	m += G[i].getFakeDegree();
 	if (f.cond(i)) {
 	    intT d = G[i].getFakeDegree();
+	    typename vertex::neighborIter it = G[i].getInIter();
 	    for(intT j=0; j<d; j++){
-		uintT ngh = G[i].getInNeighbor(j);
+		uintT ngh = it.next();
 		if (currBitVector[ngh-currOffset] && f.updateAtomic(ngh, i)) {
 		    nextBitVector[i-offset] = true;
 		}
@@ -1419,8 +2240,9 @@ void edgeMapSparseAsync(graph<vertex> GA, vertices *frontier, F f, LocalFrontier
 		accumSize++;
 		intT idx = currChunk->s[i];
 		intT d = V[idx].getOutDegree();
+		typename vertex::neighborIter it = V[idx].getOutIter();
 		for (intT j = 0; j < d; j++) {
-		    intT ngh = V[idx].getOutNeighbor(j);
+		    intT ngh = it.next();
 		    if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
 			//add ngh into chunk
 			myChunk->s[myChunk->m] = ngh;
@@ -1581,8 +2403,9 @@ void edgeMapSparseAsyncPipe(graph<vertex> GA, vertices *frontier, F f, LocalFron
 		    accumSize++;
 		    intT idx = currChunk->s[i];
 		    intT d = V[idx].getOutDegree();
+		    typename vertex::neighborIter it = V[idx].getOutIter();
 		    for (intT j = 0; j < d; j++) {
-			intT ngh = V[idx].getOutNeighbor(j);
+			intT ngh = it.next();
 			if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
 			    //add ngh into chunk
 			    int counter = __sync_fetch_and_add(&(bitVec[ngh - offset]), 1);
@@ -1771,7 +2594,7 @@ void edgeMapSparseV5(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	next->outEdgesCount = 0;
 	int bufferLen = frontier->getEdgeStat();
 	if (subworker.isSubMaster()) {
-	    next->s = (intT *)malloc(sizeof(intT) * bufferLen);
+	    next->reserveSparse(bufferLen);
 	}
 	intT nextEdgesCount = 0;
 	
@@ -1799,8 +2622,9 @@ void edgeMapSparseV5(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	    }
 	    intT idx = currActiveList[i - offset];
 	    intT d = V[idx].getFakeDegree();
+	    typename vertex::neighborIter it = V[idx].getOutIter();
 	    for (intT j = 0; j < d; j++) {
-		uintT ngh = V[idx].getOutNeighbor(j);
+		uintT ngh = it.next();
 		if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {		    
 		    next->s[tmp] = ngh;
 		    tmp++;
@@ -1835,8 +2659,10 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
     vertex *V = GA.V;
     
     intT nextM = 0;
-    intT *nextChunk = (intT *)malloc(sizeof(intT) * next->n);
+    intT *nextChunk = NULL;
     intT nextEdgesCount = 0;
+    if (subworker.isSubMaster())
+	next->prepareArenas(subworker.numOfSub);
     if (firstTime) {
 	intT currM = frontier->numNonzeros();
 	int startPos = subworker.getStartPos(currM);
@@ -1847,6 +2673,7 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
+	nextChunk = (intT *)next->subArenas[subworker.subTid].alloc(sizeof(intT) * next->n);
 
 	if (startPos < endPos) {
 	    int currNodeNum = frontier->getNodeNumOfSparseIndex(startPos);
@@ -1870,8 +2697,9 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 		}
 		intT idx = currActiveList[i - offset];
 		intT d = V[idx].getFakeDegree();
+		typename vertex::neighborIter it = V[idx].getOutIter();
 		for (intT j = 0; j < d; j++) {
-		    uintT ngh = V[idx].getOutNeighbor(j);
+		    uintT ngh = it.next();
 		    if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
 			nextChunk[nextM] = ngh;
 			nextM++;
@@ -1893,6 +2721,7 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	next->m = 0;
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
+	nextChunk = (intT *)next->subArenas[subworker.subTid].alloc(sizeof(intT) * next->n);
 	
 	intT fetchedChunk = __sync_fetch_and_add(&(next->sparseCounter), 1);
 	while (fetchedChunk < numOfChunks) {
@@ -1904,8 +2733,9 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	    for (int i = 0; i < chunkSize; i++) {
 		intT idx = chunk[i];
 		intT d = V[idx].getFakeDegree();
+		typename vertex::neighborIter it = V[idx].getOutIter();
 		for (intT j = 0; j < d; j++) {
-		    uintT ngh = V[idx].getOutNeighbor(j);
+		    uintT ngh = it.next();
 		    if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
 			nextChunk[nextM] = ngh;
 			nextM++;
@@ -1926,24 +2756,27 @@ void edgeMapSparseV4(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 }
 
 template <class F, class vertex>
-void edgeMapSparseV3(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner) {
+void edgeMapSparseV3(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner, bool remDups = false) {
     vertex *V = GA.V;
     if (part) {
 	intT currM = frontier->numNonzeros();
 	int startPos = subworker.getStartPos(currM);
 	int endPos = subworker.getEndPos(currM);
 
-	intT *mPtr = &(next->m);
-	*mPtr = 0;
 	next->outEdgesCount = 0;
-	int bufferLen = frontier->getEdgeStat();
-	if (subworker.isSubMaster())
-	    next->s = (intT *)malloc(sizeof(intT) * bufferLen);
+	if (subworker.isSubMaster()) {
+	    next->prepareArenas(subworker.numOfSub);
+	    if (next->chunks == NULL)
+		next->chunks = newSparseChunks(subworker.numOfSub, next->subArenas);
+	}
+	if (remDups && subworker.isSubMaster())
+	    next->beginClaims();
 	intT nextEdgesCount = 0;
 	
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
-	intT *nextFrontier = next->s;
+	sparseChunk &out = next->chunks[subworker.subTid];
+	out.n = 0;
 
 	if (startPos < endPos) {
 	    //printf("have ele: %d to %d %d, %p\n", startPos, endPos, subworker.tid, next);	    
@@ -1974,9 +2807,10 @@ void edgeMapSparseV3(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 		//printf("vertex on %d %d: %d\n", subworker.tid, subworker.subTid, idx);
 		intT d = V[idx].getFakeDegree();
 		//printf("degree: %d\n", d);
+		typename vertex::neighborIter it = V[idx].getOutIter();
 		for (intT j = 0; j < d; j++) {
-		    uintT ngh = V[idx].getOutNeighbor(j);
-		    if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
+		    uintT ngh = it.next();
+		    if (f.cond(ngh) && f.updateAtomic(idx, ngh) && (!remDups || next->claim(ngh))) {
 			//add to active list
 			//printf("out edge # %d: %d -> %d of %d %d\n", nextM, idx, ngh, subworker.tid, subworker.subTid);
 			/*
@@ -1985,10 +2819,7 @@ void edgeMapSparseV3(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 			}
 			*/
 			//printf("I am here\n");
-			int tmp = __sync_fetch_and_add(mPtr, 1);
-			if (tmp >= bufferLen)
-			    printf("oops\n");
-			nextFrontier[tmp] = ngh;
+			out.push(ngh);
 			nextEdgesCount += V[ngh].getOutDegree();
 		    }
 		}
@@ -1996,12 +2827,75 @@ void edgeMapSparseV3(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 		//printf("nextM: %d %d\n", nextM, nextEdgesCount);
 	    }
 	}
+	next->gatherChunks(subworker);
 	__sync_fetch_and_add(&(next->outEdgesCount), nextEdgesCount);
 	//pthread_barrier_wait(subworker.local_barr);
 	subworker.localWait();
     }
 }
 
+// edgeMapSparseV3 over a compact local graph: every active vertex is
+// looked up by binary search, those without local out-edges are skipped.
+template <class F, class vertex>
+void edgeMapSparseV3(compactGraph<vertex> &GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner, bool remDups = false) {
+    if (!part)
+	return;
+    intT currM = frontier->numNonzeros();
+    int startPos = subworker.getStartPos(currM);
+    int endPos = subworker.getEndPos(currM);
+
+    next->outEdgesCount = 0;
+    if (subworker.isSubMaster()) {
+	next->prepareArenas(subworker.numOfSub);
+	if (next->chunks == NULL)
+	    next->chunks = newSparseChunks(subworker.numOfSub, next->subArenas);
+    }
+    if (remDups && subworker.isSubMaster())
+	next->beginClaims();
+    intT nextEdgesCount = 0;
+
+    subworker.localWait();
+    sparseChunk &out = next->chunks[subworker.subTid];
+    out.n = 0;
+
+    if (startPos < endPos) {
+	int currNodeNum = frontier->getNodeNumOfSparseIndex(startPos);
+	int offset = 0;
+	for (int i = 0; i < currNodeNum; i++) {
+	    offset += frontier->getSparseSize(i);
+	}
+	intT *currActiveList = frontier->getSparseArr(currNodeNum);
+	int lengthOfCurr = frontier->getSparseSize(currNodeNum) - (startPos - offset);
+	for (int i = startPos; i < endPos; i++) {
+	    if (lengthOfCurr <= 0) {
+		while (currNodeNum + 1 < frontier->numOfNodes && lengthOfCurr <= 0) {
+		    offset += frontier->getSparseSize(currNodeNum);
+		    currNodeNum++;
+		    lengthOfCurr = frontier->getSparseSize(currNodeNum);
+		}
+		currActiveList = frontier->getSparseArr(currNodeNum);
+	    }
+	    intT idx = currActiveList[i - offset];
+	    lengthOfCurr--;
+	    vertex *v = GA.find(idx);
+	    if (v == NULL)
+		continue;
+	    intT d = v->getFakeDegree();
+	    typename vertex::neighborIter it = v->getOutIter();
+	    for (intT j = 0; j < d; j++) {
+		uintT ngh = it.next();
+		if (f.cond(ngh) && f.updateAtomic(idx, ngh) && (!remDups || next->claim(ngh))) {
+		    out.push(ngh);
+		    nextEdgesCount += GA.getOutDegree(ngh);
+		}
+	    }
+	}
+    }
+    next->gatherChunks(subworker);
+    __sync_fetch_and_add(&(next->outEdgesCount), nextEdgesCount);
+    subworker.localWait();
+}
+
 template <class F, class vertex>
 void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *next, bool part = false, Subworker_Partitioner &subworker = dummyPartitioner) {
     vertex *V = GA.V;
@@ -2013,12 +2907,14 @@ void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	intT nextM = 0;
 	intT nextEdgesCount = 0;
 	intT *nextFrontier = NULL;
+	if (subworker.isSubMaster())
+	    next->prepareArenas(subworker.numOfSub);
 	pthread_barrier_wait(subworker.local_barr);
 
 	if (startPos < endPos) {
 	    //printf("have ele: %d to %d %d, %p\n", startPos, endPos, subworker.tid, next);
 	    int bufferLen = frontier->getEdgeStat();
-	    nextFrontier = (intT *)malloc(sizeof(intT) * bufferLen);
+	    nextFrontier = (intT *)next->subArenas[subworker.subTid].alloc(sizeof(intT) * bufferLen);
 	    
 	    int currNodeNum = frontier->getNodeNumOfSparseIndex(startPos);
 	    int offset = 0;
@@ -2046,8 +2942,9 @@ void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 		intT idx = currActiveList[i - offset];
 		//printf("vertex on %d %d: %d\n", subworker.tid, subworker.subTid, idx);
 		intT d = V[idx].getFakeDegree();
+		typename vertex::neighborIter it = V[idx].getOutIter();
 		for (intT j = 0; j < d; j++) {
-		    uintT ngh = V[idx].getOutNeighbor(j);
+		    uintT ngh = it.next();
 		    if (f.cond(ngh) && f.updateAtomic(idx, ngh)) {
 			//add to active list
 			//printf("out edge # %d: %d -> %d of %d %d\n", nextM, idx, ngh, subworker.tid, subworker.subTid);
@@ -2072,7 +2969,7 @@ void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	writeAdd(&(next->m), nextM);
 	writeAdd(&(next->outEdgesCount), nextEdgesCount);
 	if (subworker.isSubMaster()) {
-	    intT *offsets = (intT *)malloc(sizeof(intT) * subworker.numOfSub);
+	    intT *offsets = (intT *)next->arena.alloc(sizeof(intT) * subworker.numOfSub);
 	    next->tmp = offsets;
 	}
 	//gettimeofday(&start1, &tz);
@@ -2082,9 +2979,7 @@ void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 	if (subworker.isSubMaster()) {
 	    //printf("next of %d: %d %d\n", subworker.tid, next->m, nextM);
 	    if (next->m > 0) {
-		intT *sparseArr = (intT *)malloc(sizeof(intT) * next->m);
-		//printf("next sparse: %p\n", sparseArr);
-		next->s = sparseArr;
+		next->reserveSparse(next->m);
 	    }
 	    next->isDense = false;
 	}
@@ -2103,9 +2998,6 @@ void edgeMapSparseV2(graph<vertex> GA, vertices *frontier, F f, LocalFrontier *n
 		}
 		//printf("filled to %d of %d: %d\n", i + fillOffset, subworker.tid, nextFrontier[i]);
 	    }
-	    if (startPos < endPos) {
-		free(nextFrontier);
-	    }
 	}
 	//gettimeofday(&start3, &tz);
 	pthread_barrier_wait(subworker.local_barr);
@@ -2237,6 +3129,54 @@ void switchFrontier(int nodeNum, vertices *V, LocalFrontier* &next) {
 
 void clearLocalFrontier(LocalFrontier *next, int nodeNum, int subNum, int totalSub);
 
+// With a Direction_Optimizer (see direction.h) the submasters pick
+// their nodes' modes and the master readies the frontiers for them.
+// Returns whether this node runs dense.
+inline bool chooseDirection(vertices *V, Subworker_Partitioner &subworker) {
+    Direction_Optimizer *dir = subworker.direction;
+    if (subworker.isSubMaster())
+	dir->decide(V->numNonzeros(), V->getEdgeStat(), V->numOfVertices);
+    subworker.globalWait();
+    if (subworker.isMaster())
+	V->prepareModes(dir->modes);
+    if (subworker.isSubMaster())
+	dir->startRound();
+    return dir->modes[subworker.tid];
+}
+
+// times the node's round once all its subworkers are done
+inline void finishDirection(Subworker_Partitioner &subworker) {
+    if (subworker.direction == NULL)
+	return;
+    subworker.localWait();
+    if (subworker.isSubMaster())
+	subworker.direction->endRound();
+}
+
+// Runs this subworker's part of the blocks its node borrowed from its
+// neighbours (see Node_Balancer in rebalance.h) on the lenders' local
+// graphs, writing into their next frontiers. Returns the work done.
+template <class F, class graphType>
+long edgeMapDenseBorrowed(graphType &, vertices *V, F f, Subworker_Partitioner &subworker) {
+    Node_Balancer *nodes = (subworker.balancer != NULL) ? subworker.balancer->nodes : NULL;
+    if (nodes == NULL)
+	return 0;
+    long total = 0;
+    for (int side = 0; side < 2; side++) {
+	int lender;
+	intT lo, hi, start, end;
+	if (!nodes->borrowedBlock(subworker.tid, side, lender, lo, hi))
+	    continue;
+	subworker.borrowedPart(lo, hi, start, end);
+	if (start >= end)
+	    continue;
+	long work = 0;
+	edgeMapDenseForward(*(graphType *)nodes->graphs[lender], V, f, V->nextFrontiers[lender], true, start, end, &work);
+	total += work;
+    }
+    return total;
+}
+
 // decides on sparse or dense base on number of nonzeros in the active vertices
 template <class F, class vertex>
 void edgeMap(graph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT threshold = -1, 
@@ -2257,15 +3197,17 @@ void edgeMap(graph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT thres
     int start = subworker.dense_start;
     int end = subworker.dense_end;
 
-    if (m >= threshold) {       
+    bool dense = (subworker.direction != NULL) ? chooseDirection(V, subworker) : (m >= threshold);
+    if (dense) {       
 	//Dense part	
-	if (subworker.isMaster()) {
+	if (subworker.isMaster() && subworker.direction == NULL) {
 	    printf("Dense: %d\n", m);
 	    V->toDense();
 	}
 
 	if (subworker.isSubMaster()) {
 	    next->sparseCounter = 0;
+	    V->nextFrontiers[subworker.tid] = next;
 	}
 
 	clearLocalFrontier(next, subworker.tid, subworker.subTid, subworker.numOfSub);
@@ -2273,15 +3215,19 @@ void edgeMap(graph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT thres
 	//pthread_barrier_wait(subworker.global_barr);
 	subworker.globalWait();
 	
+	long work = 0;
 	bool* R = (option == DENSE_FORWARD) ? 
-	    edgeMapDenseForward(GA, V, f, next, part, start, end) :
+	    edgeMapDenseForward(GA, V, f, next, part, start, end, &work) :
 	    //edgeMapDenseForwardDynamic(GA, V, f, next, subworker) : 
 	    //edgeMapDense(GA, V, f, next, option, subworker);
             edgeMapDenseDynamic(GA, V, f, next, subworker);
+	long borrowed = (option == DENSE_FORWARD) ? edgeMapDenseBorrowed(GA, V, f, subworker) : 0;
 	next->isDense = true;
+	if (option == DENSE_FORWARD)
+	    subworker.balanceDense(work, borrowed);
     } else {
 	//Sparse part
-	if (subworker.isMaster()) {
+	if (subworker.isMaster() && subworker.direction == NULL) {
 	    printf("Sparse: %d %d\n", V->numNonzeros(), m);
 	    V->toSparse();
 	}
@@ -2301,16 +3247,33 @@ void edgeMap(graph<vertex> GA, vertices *V, F f, LocalFrontier *next, intT thres
 	    printf("my first sparse\n");
 	}
 	
-	edgeMapSparseV3(GA, V, f, next, part, subworker);
+	edgeMapSparseV3(GA, V, f, next, part, subworker, remDups);
 	//edgeMapSparseV4(GA, V, f, next, V->firstSparse, subworker);
 	//edgeMapSparseV5(GA, V, f, next, subworker);
 	next->isDense = false;
     }
+    finishDirection(subworker);
 }
 
 //*****VERTEX FUNCTIONS*****
-template<class vertex>
-void vertexCounter(graph<vertex> GA, LocalFrontier *frontier, int nodeNum, int subNum, int totalSub) {
+// full out-degree of vertex i, for the frontier statistics
+template <class vertex>
+inline intT fullOutDegree(graph<vertex> &GA, intT i) { return GA.V[i].getOutDegree(); }
+
+template <class vertex>
+inline intT fullOutDegree(compactGraph<vertex> &GA, intT i) { return GA.getOutDegree(i); }
+
+template <class graphType>
+struct vertexDegreeSum {
+    graphType &GA;
+    int offset;
+    intT total;
+    vertexDegreeSum(graphType &_GA, int _offset) : GA(_GA), offset(_offset), total(0) {}
+    inline void operator() (long i) { total += fullOutDegree(GA, i + offset); }
+};
+
+template<class graphType>
+void vertexCounter(graphType &GA, LocalFrontier *frontier, int nodeNum, int subNum, int totalSub) {
     if (!frontier->isDense)
 	return;
     
@@ -2327,10 +3290,17 @@ void vertexCounter(graph<vertex> GA, LocalFrontier *frontier, int nodeNum, int s
     int m = 0;
     intT outEdges = 0;
 
-    for (int i = startPos; i < endPos; i++) {
-	if (b[i]) {
-	    outEdges += GA.V[i+offset].getOutDegree();
-	    m++;
+    if (frontier->bits != NULL) {
+	vertexDegreeSum<graphType> sum(GA, offset);
+	bitmapForEach(frontier->bits, startPos, endPos, sum, frontier->summary);
+	m = bitmapCount(frontier->bits, startPos, endPos, frontier->summary);
+	outEdges = sum.total;
+    } else {
+	for (int i = startPos; i < endPos; i++) {
+	    if (b[i]) {
+		outEdges += fullOutDegree(GA, i + offset);
+		m++;
+	    }
 	}
     }
     __sync_fetch_and_add(&(frontier->m), m);
@@ -2348,6 +3318,14 @@ void vertexMap(vertices *V, F add, int nodeNum) {
     }
 }
 
+template <class F>
+struct offsetCall {
+    F &f;
+    int offset;
+    offsetCall(F &_f, int _offset) : f(_f), offset(_offset) {}
+    inline void operator() (long i) { f(i + offset); }
+};
+
 template <class F>
 void vertexMap(vertices *V, F add, int nodeNum, int subNum, int totalSub) {
     if (V->isDense) {
@@ -2361,6 +3339,12 @@ void vertexMap(vertices *V, F add, int nodeNum, int subNum, int totalSub) {
 	    endPos = size;
 	}
 	
+	LocalFrontier *local = V->getFrontier(nodeNum);
+	if (local->bits != NULL) {
+	    offsetCall<F> call(add, offset);
+	    bitmapForEach(local->bits, startPos, endPos, call, local->summary);
+	    return;
+	}
 	for (int i = startPos; i < endPos; i++) {
 	    if (b[i])
 		add(i + offset);
@@ -2381,6 +3365,14 @@ void vertexMap(vertices *V, F add, int nodeNum, int subNum, int totalSub) {
 }
 
 void clearLocalFrontier(LocalFrontier *next, int nodeNum, int subNum, int totalSub) {
+    if (next->bits != NULL) {
+	// split by summary words, so that no two subworkers store to one
+	long words = bitmapSummaryWords(next->n);
+	long subWords = words / totalSub;
+	long endWord = (subNum == totalSub - 1) ? words : subWords * (subNum + 1);
+	bitmapClearSummarized(next->bits, next->summary, subWords * subNum, endWord);
+	return;
+    }
     int size = next->endID - next->startID;
     //int offset = V->getOffset(nodeNum);
     bool *b = next->b;
@@ -0,0 +1,287 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+
+#ifndef REBALANCE_INCLUDED
+#define REBALANCE_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include "parallel.h"
+
+// Dense edgeMaps give every subworker a fixed range of vertices, cut by
+// subPartitionByDegree before the first iteration. Frontier-driven apps
+// later concentrate their active edges in a few of these ranges, and the
+// other subworkers wait for them at the next barrier.
+//
+// After each dense round every subworker reports the work of its range
+// (vertices scanned plus edges traversed). When the largest share stays
+// above BALANCE_THRESHOLD times the average for BALANCE_ROUNDS rounds in
+// a row, the submaster moves the cuts so that every range gets an equal
+// share of the last round's work, taking it as spread evenly within each
+// old range. The node's total is kept per round so that the imbalance
+// between nodes can be reported after the run.
+//
+// Nodes wait for each other the same way at the global barrier. With a
+// Node_Balancer the dense loops of neighbouring nodes also trade blocks of
+// rows at their boundary. Every node has a row space, the rows its dense
+// loop visits: the sources of its local graph for the forward loops, its
+// own vertices for BFS's pull loop. Between nodes k and k+1 a flow moves
+// the last rows of k's space to k+1 when positive, and the first rows of
+// k+1's space to k when negative. The borrowing node runs a block on the
+// lender's local graph and writes the lender's next frontier, so the
+// frontiers, vertex data and graphs stay where they were placed at
+// startup; only the work moves, at the price of remote accesses. After a
+// dense round every node reports its work. When the busiest node stays
+// above BALANCE_THRESHOLD times the average for BALANCE_ROUNDS rounds,
+// every boundary moves half the difference between its two nodes, in
+// rows of the giving node at that node's last cost per row. A node never
+// gives away more than BALANCE_MAX_LEND of its space on either side.
+
+#define BALANCE_THRESHOLD (1.1)
+#define BALANCE_ROUNDS (2)
+#define BALANCE_MAX_LEND (0.25)
+
+struct Node_Balancer {
+    int numOfNodes;
+    int numOfSub;     // subworkers per node; every node keeps rows for each
+    intT *first;      // row space of every node's dense loop
+    intT *last;
+    void **graphs;    // every node's local graph, for the borrowed blocks
+    long *flow;       // per boundary, see above
+    long *work;       // work of every node in the last dense round
+    long *ownWork;    // the part of it done on the node's own rows
+    int skewedRounds;
+    int moves;        // times the boundaries were moved
+
+    Node_Balancer(int _numOfNodes, int _numOfSub) :
+	numOfNodes(_numOfNodes), numOfSub(_numOfSub), skewedRounds(0), moves(0) {
+	first = newA(intT, numOfNodes);
+	last = newA(intT, numOfNodes);
+	graphs = newA(void *, numOfNodes);
+	flow = newA(long, numOfNodes);
+	work = newA(long, numOfNodes);
+	ownWork = newA(long, numOfNodes);
+	for (int k = 0; k < numOfNodes; k++) {
+	    first[k] = last[k] = 0;
+	    graphs[k] = NULL;
+	    flow[k] = work[k] = ownWork[k] = 0;
+	}
+    }
+
+    // each node thread, before its subworkers start
+    void setNode(int k, intT _first, intT _last, void *graph) {
+	first[k] = _first;
+	last[k] = _last;
+	graphs[k] = graph;
+    }
+
+    // the rows of node k's own space that node k still runs
+    intT ownStart(int k) {
+	return first[k] + ((k > 0 && flow[k - 1] < 0) ? -flow[k - 1] : 0);
+    }
+    intT ownEnd(int k) {
+	return last[k] - ((k < numOfNodes - 1 && flow[k] > 0) ? flow[k] : 0);
+    }
+
+    // the block node k runs for its left (side 0) or right (side 1)
+    // neighbour: rows [lo, hi) of lender's space; false when there is none
+    bool borrowedBlock(int k, int side, int &lender, intT &lo, intT &hi) {
+	if (side == 0 && k > 0 && flow[k - 1] > 0) {
+	    lender = k - 1;
+	    lo = last[lender] - flow[k - 1];
+	    hi = last[lender];
+	    return true;
+	}
+	if (side == 1 && k < numOfNodes - 1 && flow[k] < 0) {
+	    lender = k + 1;
+	    lo = first[lender];
+	    hi = first[lender] - flow[k];
+	    return true;
+	}
+	return false;
+    }
+
+    long maxLend(int k) {
+	intT size = last[k] - first[k];
+	return (size < 4 * numOfSub) ? 0 : (long)(BALANCE_MAX_LEND * size);
+    }
+
+    // master only, once every node has stored its work
+    void rebalance() {
+	long total = 0, most = 0;
+	for (int k = 0; k < numOfNodes; k++) {
+	    total += work[k];
+	    most = max(most, work[k]);
+	}
+	if (total == 0 || most <= BALANCE_THRESHOLD * total / numOfNodes) {
+	    skewedRounds = 0;
+	    return;
+	}
+	if (++skewedRounds < BALANCE_ROUNDS)
+	    return;
+	skewedRounds = 0;
+	moves++;
+	for (int k = 0; k < numOfNodes - 1; k++) {
+	    long diff = (work[k] - work[k + 1]) / 2;
+	    int giver = (diff > 0) ? k : k + 1;
+	    intT rows = ownEnd(giver) - ownStart(giver);
+	    if (diff == 0 || rows <= 0 || ownWork[giver] <= 0)
+		continue;
+	    long moved = (long)(labs(diff) / ((double)ownWork[giver] / rows));
+	    long maxLeft = maxLend(k);
+	    long maxRight = maxLend(k + 1);
+	    flow[k] += (diff > 0) ? moved : -moved;
+	    flow[k] = min(maxLeft, max(-maxRight, flow[k]));
+	}
+    }
+};
+
+// Cuts [lo, hi) into numOfSub non-empty ranges of about equal total
+// weight(i), into sizeArr; hi - lo must be at least numOfSub.
+template <class W>
+void cutByWeight(intT lo, intT hi, int numOfSub, int *sizeArr, W weight) {
+    long total = 0;
+    for (intT i = lo; i < hi; i++) total += weight(i);
+    intT start = lo;
+    long acc = 0;
+    intT i = lo;
+    for (int s = 0; s < numOfSub - 1; s++) {
+	long target = total * (s + 1) / numOfSub;
+	while (i < hi - (numOfSub - 1 - s) && (i == start || acc < target))
+	    acc += weight(i++);
+	sizeArr[s] = i - start;
+	start = i;
+    }
+    sizeArr[numOfSub - 1] = hi - start;
+}
+
+struct Dense_Balancer {
+    int numOfSub;
+    int node;
+    intT *cuts;       // numOfSub + 1 boundaries of the subworkers' ranges
+    long *work;       // work of each subworker in the last dense round
+    long *borrowed;   // the part of it done on blocks of other nodes
+    Node_Balancer *nodes; // moves blocks between nodes when set
+    int skewedRounds; // consecutive rounds above BALANCE_THRESHOLD
+    int moves;        // times the cuts were moved
+    std::vector<long> history; // work of the whole node, per dense round
+
+    Dense_Balancer(int _numOfSub, int _node, intT first, int *sizeArr, Node_Balancer *_nodes = NULL) :
+	numOfSub(_numOfSub), node(_node), nodes(_nodes), skewedRounds(0), moves(0) {
+	cuts = newA(intT, numOfSub + 1);
+	work = newA(long, numOfSub);
+	borrowed = newA(long, numOfSub);
+	cuts[0] = first;
+	for (int i = 0; i < numOfSub; i++) {
+	    cuts[i + 1] = cuts[i] + sizeArr[i];
+	    work[i] = borrowed[i] = 0;
+	}
+    }
+
+    // submaster only, once every subworker has stored its work
+    void rebalance() {
+	long total = 0, most = 0, lent = 0;
+	for (int i = 0; i < numOfSub; i++) {
+	    total += work[i];
+	    lent += borrowed[i];
+	    most = max(most, work[i]);
+	}
+	history.push_back(total + lent);
+	if (nodes != NULL) {
+	    nodes->work[node] = total + lent;
+	    nodes->ownWork[node] = total;
+	}
+	if (total == 0 || most <= BALANCE_THRESHOLD * total / numOfSub) {
+	    skewedRounds = 0;
+	    return;
+	}
+	const intT first = cuts[0], last = cuts[numOfSub];
+	if (++skewedRounds < BALANCE_ROUNDS || last - first < numOfSub)
+	    return;
+	skewedRounds = 0;
+	moves++;
+
+	intT newCuts[numOfSub + 1];
+	newCuts[0] = first;
+	newCuts[numOfSub] = last;
+	int j = 0;
+	double before = 0; // work of the old ranges left of j
+	for (int s = 1; s < numOfSub; s++) {
+	    double target = (double)total * s / numOfSub;
+	    while (j < numOfSub - 1 && before + work[j] < target) before += work[j++];
+	    double frac = (work[j] > 0) ? (target - before) / work[j] : 0;
+	    intT cut = cuts[j] + (intT)(frac * (cuts[j + 1] - cuts[j]));
+	    // keep every range non-empty
+	    newCuts[s] = min(max(cut, newCuts[s - 1] + 1), last - (numOfSub - s));
+	}
+	for (int s = 1; s < numOfSub; s++) cuts[s] = newCuts[s];
+    }
+
+    // submaster only: stretches the cuts over [lo, hi), the node's own
+    // rows once the Node_Balancer has moved its boundaries
+    void retarget(intT lo, intT hi) {
+	const intT first = cuts[0], last = cuts[numOfSub];
+	if (first == lo && last == hi)
+	    return;
+	double scale = (last > first) ? (double)(hi - lo) / (last - first) : 0;
+	cuts[0] = lo;
+	cuts[numOfSub] = hi;
+	for (int s = 1; s < numOfSub; s++) {
+	    intT cut = lo + (intT)((cuts[s] - first) * scale);
+	    cuts[s] = min(max(cut, cuts[s - 1] + 1), hi - (numOfSub - s));
+	}
+    }
+};
+
+// Prints the work of every node in each dense round and the imbalance
+// between nodes (largest over average), then how often each node moved
+// its ranges. balancers holds one entry per node.
+void reportBalance(Dense_Balancer **balancers, int numOfNodes) {
+    size_t rounds = balancers[0]->history.size();
+    for (int k = 1; k < numOfNodes; k++) rounds = min(rounds, balancers[k]->history.size());
+    for (size_t r = 0; r < rounds; r++) {
+	long total = 0, most = 0;
+	printf("dense round %d work:", (int)r + 1);
+	for (int k = 0; k < numOfNodes; k++) {
+	    long w = balancers[k]->history[r];
+	    printf(" %ld", w);
+	    total += w;
+	    most = max(most, w);
+	}
+	printf(", node imbalance %.3f\n", total > 0 ? most * numOfNodes / (double)total : 1.0);
+    }
+    for (int k = 0; k < numOfNodes; k++)
+	printf("node %d moved its dense ranges %d times\n", k, balancers[k]->moves);
+    Node_Balancer *nodes = balancers[0]->nodes;
+    if (nodes == NULL)
+	return;
+    printf("node boundaries moved %d times, final blocks:", nodes->moves);
+    for (int k = 0; k < numOfNodes - 1; k++)
+	printf(" %ld", nodes->flow[k]);
+    printf("\n");
+}
+
+#endif
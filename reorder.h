@@ -0,0 +1,241 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef REORDER_INCLUDED
+#define REORDER_INCLUDED
+
+#include <math.h>
+#include <queue>
+#include "parallel.h"
+#include "quickSort.h"
+
+// Locality-improving vertex orderings, used in place of the round-robin
+// Hash_F before partitioning. Each returns perm with perm[old] = new;
+// Perm_Hash_F wraps it, with its inverse, so that graphAllEdgeHasher can
+// apply it and results can be mapped back to the input ids.
+//
+//   degree  vertices by decreasing in+out degree, hubs first
+//   rcm     reverse Cuthill-McKee over the undirected graph
+//   gorder  windowed greedy placement after Gorder (Wei et al., SIGMOD'16):
+//           the next vertex is the one sharing the most edges and common
+//           in-neighbors with the last GORDER_WINDOW placed vertices
+
+enum { ORDER_NONE, ORDER_DEGREE, ORDER_RCM, ORDER_GORDER };
+
+#define GORDER_WINDOW 5
+
+int parseOrder(const char *name) {
+  if (strcmp(name, "degree") == 0) return ORDER_DEGREE;
+  if (strcmp(name, "rcm") == 0) return ORDER_RCM;
+  if (strcmp(name, "gorder") == 0) return ORDER_GORDER;
+  if (strcmp(name, "none") == 0) return ORDER_NONE;
+  cout << "unknown order " << name << ", use degree, rcm, gorder or none" << endl;
+  abort();
+}
+
+struct Perm_Hash_F {
+  intT *perm; // old id -> new id
+  intT *inv;  // new id -> old id
+  Perm_Hash_F(intT *_perm, intT n) : perm(_perm) {
+    inv = newA(intT, n);
+    {parallel_for (intT i = 0; i < n; i++) inv[perm[i]] = i;}
+  }
+  inline int hashFunc(int index) { return perm[index]; }
+  inline int hashBackFunc(int index) { return inv[index]; }
+  void del() { free(perm); free(inv); }
+};
+
+struct degreeCmp {
+  intT *deg;
+  degreeCmp(intT *_deg) : deg(_deg) {}
+  bool operator() (intT a, intT b) {
+    return deg[a] < deg[b] || (deg[a] == deg[b] && a < b);
+  }
+};
+
+struct degreeDescCmp {
+  intT *deg;
+  degreeDescCmp(intT *_deg) : deg(_deg) {}
+  bool operator() (intT a, intT b) {
+    return deg[a] > deg[b] || (deg[a] == deg[b] && a < b);
+  }
+};
+
+// turns an order (position -> old id) into perm and frees it
+intT *orderToPerm(intT *order, intT n) {
+  intT *perm = newA(intT, n);
+  {parallel_for (intT k = 0; k < n; k++) perm[order[k]] = k;}
+  free(order);
+  return perm;
+}
+
+template <class vertex>
+intT *totalDegrees(graph<vertex> &GA) {
+  intT *deg = newA(intT, GA.n);
+  {parallel_for (intT i = 0; i < GA.n; i++) deg[i] = GA.V[i].getOutDegree() + GA.V[i].getInDegree();}
+  return deg;
+}
+
+template <class vertex>
+intT *degreeOrder(graph<vertex> &GA) {
+  intT *deg = totalDegrees(GA);
+  intT *order = newA(intT, GA.n);
+  {parallel_for (intT i = 0; i < GA.n; i++) order[i] = i;}
+  quickSort(order, GA.n, degreeDescCmp(deg));
+  free(deg);
+  return orderToPerm(order, GA.n);
+}
+
+// Breadth-first from the lowest-degree unvisited vertex of every component,
+// queueing the unvisited neighbors of each vertex by increasing degree;
+// the final order is reversed.
+template <class vertex>
+intT *rcmOrder(graph<vertex> &GA) {
+  const intT n = GA.n;
+  intT *deg = totalDegrees(GA);
+  intT *starts = newA(intT, n);
+  {parallel_for (intT i = 0; i < n; i++) starts[i] = i;}
+  quickSort(starts, n, degreeCmp(deg));
+  bool *visited = newA(bool, n);
+  {parallel_for (intT i = 0; i < n; i++) visited[i] = false;}
+  intT *order = newA(intT, n);
+  intT tail = 0;
+  for (intT s = 0; s < n; s++) {
+    if (visited[starts[s]]) continue;
+    visited[starts[s]] = true;
+    order[tail++] = starts[s];
+    for (intT head = tail - 1; head < tail; head++) {
+      vertex &v = GA.V[order[head]];
+      intT first = tail;
+      for (intT j = 0; j < v.getOutDegree(); j++) {
+	intE u = v.getOutNeighbor(j);
+	if (!visited[u]) { visited[u] = true; order[tail++] = u; }
+      }
+      for (intT j = 0; j < v.getInDegree(); j++) {
+	intE u = v.getInNeighbor(j);
+	if (!visited[u]) { visited[u] = true; order[tail++] = u; }
+      }
+      quickSort(order + first, tail - first, degreeCmp(deg));
+    }
+  }
+  for (intT k = 0; k < n / 2; k++) swap(order[k], order[n - 1 - k]);
+  free(visited);
+  free(starts);
+  free(deg);
+  return orderToPerm(order, n);
+}
+
+// Gorder score bookkeeping: adds delta to the score of every unplaced vertex
+// that is a neighbor of v or shares an in-neighbor with it. In-neighbors
+// with more than hub out-edges are not expanded, as in the original.
+template <class vertex>
+void gorderUpdate(graph<vertex> &GA, intT v, int delta, intT hub, int *score, bool *placed,
+		  priority_queue<pair<int, intT> > &heap) {
+  vertex &V = GA.V[v];
+  for (intT j = 0; j < V.getOutDegree(); j++) {
+    intE u = V.getOutNeighbor(j);
+    if (placed[u]) continue;
+    score[u] += delta;
+    if (delta > 0) heap.push(make_pair(score[u], (intT)u));
+  }
+  for (intT j = 0; j < V.getInDegree(); j++) {
+    intE x = V.getInNeighbor(j);
+    if (!placed[x]) {
+      score[x] += delta;
+      if (delta > 0) heap.push(make_pair(score[x], (intT)x));
+    }
+    if (GA.V[x].getOutDegree() > hub) continue;
+    for (intT k = 0; k < GA.V[x].getOutDegree(); k++) {
+      intE u = GA.V[x].getOutNeighbor(k);
+      if (u == v || placed[u]) continue;
+      score[u] += delta;
+      if (delta > 0) heap.push(make_pair(score[u], (intT)u));
+    }
+  }
+}
+
+// The heap holds (score, vertex) entries pushed on every increase; entries
+// whose score has since dropped are pushed again with the current score
+// when they reach the top, the rest are stale and skipped.
+template <class vertex>
+intT *gorderOrder(graph<vertex> &GA) {
+  const intT n = GA.n;
+  const intT hub = max((intT)64, (intT)sqrt((double)n));
+  int *score = newA(int, n);
+  bool *placed = newA(bool, n);
+  {parallel_for (intT i = 0; i < n; i++) { score[i] = 0; placed[i] = false; }}
+  intT *order = newA(intT, n);
+  priority_queue<pair<int, intT> > heap;
+
+  intT next = 0;
+  for (intT i = 1; i < n; i++) {
+    if (GA.V[i].getInDegree() > GA.V[next].getInDegree()) next = i;
+  }
+  intT scan = 0;
+  for (intT k = 0; k < n; k++) {
+    if (k > 0) {
+      next = -1;
+      while (!heap.empty()) {
+	pair<int, intT> top = heap.top();
+	heap.pop();
+	intT u = top.second;
+	if (placed[u] || top.first < score[u]) continue;
+	if (top.first > score[u]) {
+	  if (score[u] > 0) heap.push(make_pair(score[u], u));
+	  continue;
+	}
+	next = u;
+	break;
+      }
+      if (next < 0) {
+	while (placed[scan]) scan++;
+	next = scan;
+      }
+    }
+    placed[next] = true;
+    order[k] = next;
+    gorderUpdate(GA, next, 1, hub, score, placed, heap);
+    if (k >= GORDER_WINDOW) gorderUpdate(GA, order[k - GORDER_WINDOW], -1, hub, score, placed, heap);
+  }
+  free(score);
+  free(placed);
+  return orderToPerm(order, n);
+}
+
+template <class vertex>
+Perm_Hash_F computeOrder(graph<vertex> &GA, int order) {
+  intT *perm = NULL;
+  switch (order) {
+  case ORDER_DEGREE: perm = degreeOrder(GA); break;
+  case ORDER_RCM: perm = rcmOrder(GA); break;
+  case ORDER_GORDER: perm = gorderOrder(GA); break;
+  default:
+    perm = newA(intT, GA.n);
+    {parallel_for (intT i = 0; i < GA.n; i++) perm[i] = i;}
+  }
+  return Perm_Hash_F(perm, GA.n);
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef SPARSE_CHUNK_INCLUDED
+#define SPARSE_CHUNK_INCLUDED
+
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "frontier-arena.h"
+
+// Output buffers of the sparse edgeMaps. Every subworker appends the
+// vertices it activates to a private chunk, without atomics; once all of
+// a node's subworkers are done, each copies its chunk into the node's
+// sparse list at the offset given by the sizes of the chunks before it.
+// A chunk draws its storage from its subworker's arena of the output
+// frontier (see frontier-arena.h), which clearFrontier resets along with
+// the chunk: growing abandons the old buffer to the arena, and once the
+// slabs hold an iteration's worth of chunks, growing allocates nothing.
+
+#define SPARSE_CHUNK_MIN 256
+
+struct sparseChunk {
+    intT *A;
+    intT n;
+    intT cap;
+    frontierArena *arena;
+
+    inline void push(intT v) {
+	if (n == cap) grow();
+	A[n++] = v;
+    }
+
+    // called by the owning subworker, the only user of its arena
+    void grow() {
+	intT newCap = (cap < SPARSE_CHUNK_MIN) ? SPARSE_CHUNK_MIN : 2 * cap;
+	intT *B = (intT *)arena->alloc(sizeof(intT) * newCap);
+	if (n > 0)
+	    memcpy(B, A, sizeof(intT) * n);
+	A = B;
+	cap = newCap;
+    }
+
+    // forgets the storage, which the arena is about to take back
+    void release() {
+	A = NULL;
+	n = 0;
+	cap = 0;
+    }
+};
+
+// chunk i grows in arenas[i]
+inline sparseChunk *newSparseChunks(int numOfSub, frontierArena *arenas) {
+    sparseChunk *C = (sparseChunk *)malloc(sizeof(sparseChunk) * numOfSub);
+    for (int i = 0; i < numOfSub; i++) {
+	C[i].release();
+	C[i].arena = &arenas[i];
+    }
+    return C;
+}
+
+// where chunk k starts in the concatenated list; k = numOfSub gives its length
+inline intT sparseChunkOffset(sparseChunk *C, int k) {
+    intT pos = 0;
+    for (int i = 0; i < k; i++) pos += C[i].n;
+    return pos;
+}
+
+#endif
@@ -0,0 +1,209 @@
+/*
+ * This code is part of the project "NUMA-aware Graph-structured Analytics"
+ *
+ *
+ * Copyright (C) 2014 Institute of Parallel And Distributed Systems (IPADS), Shanghai Jiao Tong University
+ *     All rights reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ * For more about this software, visit:
+ *
+ *     http://ipads.se.sjtu.edu.cn/projects/polymer.html
+ *
+ */
+
+#ifndef TRANSPOSE_INCLUDED
+#define TRANSPOSE_INCLUDED
+
+#include "parallel.h"
+
+// Parallel two-pass counting-sort transpose used to build in-edges.
+//
+// Pass 1 cuts the sources into blocks and counts, per block, the edges
+// falling into each destination bucket (2^shift consecutive ids). Scanning
+// the counts bucket by bucket gives every block a private cursor per
+// bucket, so the (dst, src[, weight]) records are scattered without atomics.
+// Pass 2 gives each bucket to one task, which counts the in-degrees of its
+// destinations and scatters the sources to their final slots. Blocks and
+// buckets are visited in order, so every in-edge list is sorted by source.
+//
+// stride is 2 for weighted graphs, whose (neighbor, weight) pairs are
+// interleaved. The output array comes from alloc(tOffsets, n, size), which
+// is called once the in-edge offsets are known and before any edge is
+// written, so it can place the pages of each vertex range on a node.
+
+#define TRANSPOSE_BUCKETS (1 << 12)
+
+struct newInEdgeAlloc {
+  intE* operator() (long *, intT, long size) {
+    return newA(intE, size);
+  }
+};
+
+// Scans the block-major histograms bucket by bucket, turning every count
+// into the block's first slot in that bucket. Returns the total.
+long scanBucketCounts(long *counts, long numBlocks, long numBuckets, long *bucketStart) {
+  long total = 0;
+  for (long b = 0; b < numBuckets; b++) {
+    bucketStart[b] = total;
+    for (long k = 0; k < numBlocks; k++) {
+      long c = counts[k * numBuckets + b];
+      counts[k * numBuckets + b] = total;
+      total += c;
+    }
+  }
+  bucketStart[numBuckets] = total;
+  return total;
+}
+
+// Pass 2 shared by the sorts in this file. temp holds rec-wide (key, value[,
+// weight]) records grouped by bucket; bucketStart has numBuckets+1 entries.
+// Fills tOffsets[0..n] with the offset of each key's list and returns the
+// values grouped by key, in the array returned by alloc.
+template <class Alloc>
+intE* scatterBuckets(intE *temp, int stride, long *bucketStart, long numBuckets, int shift, intT n, long m, long *tOffsets, Alloc alloc) {
+  const int rec = stride + 1;
+  // list lengths, scanned within each bucket into global offsets
+  {parallel_for (long b = 0; b < numBuckets; b++) {
+      long lo = b << shift;
+      long hi = min((long)n, (b + 1) << shift);
+      for (long d = lo; d < hi; d++) tOffsets[d] = 0;
+      for (long p = bucketStart[b]; p < bucketStart[b + 1]; p++) tOffsets[temp[p * rec]]++;
+      long o = bucketStart[b];
+      for (long d = lo; d < hi; d++) {
+	long c = tOffsets[d];
+	tOffsets[d] = o;
+	o += c;
+      }
+    }}
+  tOffsets[n] = m;
+
+  intE *inEdges = alloc(tOffsets, n, m * stride);
+
+  {parallel_for (long b = 0; b < numBuckets; b++) {
+      long lo = b << shift;
+      long hi = min((long)n, (b + 1) << shift);
+      for (long p = bucketStart[b]; p < bucketStart[b + 1]; p++) {
+	intE *r = temp + p * rec;
+	long q = tOffsets[r[0]]++;
+	inEdges[q * stride] = r[1];
+	if (stride == 2) inEdges[q * stride + 1] = r[2];
+      }
+      // the cursors now hold the next vertex's offset; shift them back
+      for (long d = hi - 1; d > lo; d--) tOffsets[d] = tOffsets[d - 1];
+      if (hi > lo) tOffsets[lo] = bucketStart[b];
+    }}
+  return inEdges;
+}
+
+template <class vertex, class Alloc>
+intE* transposeEdges(vertex* v, intT n, long m, int stride, Alloc alloc) {
+  const int rec = stride + 1;
+  int shift = 0;
+  while (((long)n >> shift) >= TRANSPOSE_BUCKETS) shift++;
+  const long numBuckets = ((long)n >> shift) + 1;
+  long numBlocks = min((long)n, 8L * getWorkers());
+  if (numBlocks < 1) numBlocks = 1;
+  const long blockSize = (n + numBlocks - 1) / numBlocks;
+
+  // per-block bucket histograms, stored block-major to keep blocks apart
+  long *counts = newA(long, numBlocks * numBuckets);
+  {parallel_for (long k = 0; k < numBlocks; k++) {
+      long *c = counts + k * numBuckets;
+      for (long b = 0; b < numBuckets; b++) c[b] = 0;
+      long e = min((long)n, (k + 1) * blockSize);
+      for (long i = k * blockSize; i < e; i++) {
+	intE *ngh = v[i].getOutNeighborPtr();
+	intT d = v[i].getOutDegree();
+	for (intT j = 0; j < d; j++) c[(uintE)ngh[j * stride] >> shift]++;
+      }
+    }}
+
+  long *bucketStart = newA(long, numBuckets + 1);
+  long total = scanBucketCounts(counts, numBlocks, numBuckets, bucketStart);
+  if (total != m) {
+    cout << "transpose: edge count mismatch " << total << " " << m << endl;
+    abort();
+  }
+
+  intE *temp = newA(intE, m * rec);
+  {parallel_for (long k = 0; k < numBlocks; k++) {
+      long *cursor = counts + k * numBuckets;
+      long e = min((long)n, (k + 1) * blockSize);
+      for (long i = k * blockSize; i < e; i++) {
+	intE *ngh = v[i].getOutNeighborPtr();
+	intT d = v[i].getOutDegree();
+	for (intT j = 0; j < d; j++) {
+	  intE *r = temp + rec * cursor[(uintE)ngh[j * stride] >> shift]++;
+	  r[0] = ngh[j * stride];
+	  r[1] = i;
+	  if (stride == 2) r[2] = ngh[j * stride + 1];
+	}
+      }
+    }}
+  free(counts);
+
+  long *tOffsets = newA(long, n + 1);
+  intE *inEdges = scatterBuckets(temp, stride, bucketStart, numBuckets, shift, n, m, tOffsets, alloc);
+  free(temp);
+  free(bucketStart);
+
+  {parallel_for (long i = 0; i < n; i++) {
+      v[i].setInDegree(tOffsets[i + 1] - tOffsets[i]);
+      v[i].setInNeighbors(inEdges + stride * tOffsets[i]);
+    }}
+  free(tOffsets);
+  return inEdges;
+}
+
+// Groups the (source, destination) pairs of an edge list by source with the
+// same counting sort, giving the out-edges of a CSR. Every list keeps the
+// input order of its edges; offsets receives n+1 entries.
+intE* groupBySource(intE *pairs, long m, intT n, long *offsets) {
+  int shift = 0;
+  while (((long)n >> shift) >= TRANSPOSE_BUCKETS) shift++;
+  const long numBuckets = ((long)n >> shift) + 1;
+  long numBlocks = min(m, 8L * getWorkers());
+  if (numBlocks < 1) numBlocks = 1;
+  const long blockSize = (m + numBlocks - 1) / numBlocks;
+
+  long *counts = newA(long, numBlocks * numBuckets);
+  {parallel_for (long k = 0; k < numBlocks; k++) {
+      long *c = counts + k * numBuckets;
+      for (long b = 0; b < numBuckets; b++) c[b] = 0;
+      long e = min(m, (k + 1) * blockSize);
+      for (long p = k * blockSize; p < e; p++) c[(uintE)pairs[2 * p] >> shift]++;
+    }}
+  long *bucketStart = newA(long, numBuckets + 1);
+  scanBucketCounts(counts, numBlocks, numBuckets, bucketStart);
+
+  intE *temp = newA(intE, 2 * m);
+  {parallel_for (long k = 0; k < numBlocks; k++) {
+      long *cursor = counts + k * numBuckets;
+      long e = min(m, (k + 1) * blockSize);
+      for (long p = k * blockSize; p < e; p++) {
+	intE *r = temp + 2 * cursor[(uintE)pairs[2 * p] >> shift]++;
+	r[0] = pairs[2 * p];
+	r[1] = pairs[2 * p + 1];
+      }
+    }}
+  free(counts);
+
+  intE *edges = scatterBuckets(temp, 1, bucketStart, numBuckets, shift, n, m, offsets, newInEdgeAlloc());
+  free(temp);
+  free(bucketStart);
+  return edges;
+}
+
+#endif
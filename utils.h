@@ -43,6 +43,9 @@ struct identityF { E operator() (const E& x) {return x;}};
 template <class E>
 struct addF { E operator() (const E& a, const E& b) const {return a+b;}};
 
+template <class E>
+struct maxF { E operator() (const E& a, const E& b) const {return (a>b) ? a : b;}};
+
 #define _BSIZE 2048
 #define _SCAN_LOG_BSIZE 10
 #define _SCAN_BSIZE (1 << _SCAN_LOG_BSIZE)